@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "aof.h"
+#include "bio.h"
+#include "buffer.h"
+#include "server_common.h"
+#include "server_data.h"
+#include "server_shard.h"
+#include "slab.h"
+#include "zset.h"
+
+const uint64_t k_fsync_interval_ms = 1000;
+// rewrite once the file doubled since the last rewrite
+const uint64_t k_rewrite_min_size = 64 << 20;
+// the snapshot and the loader work in chunks of this size
+const size_t k_aof_chunk = 1 << 20;
+
+static std::string aof_path(uint32_t shard) {
+  return shard_path(g_config.aof_path, shard);
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t rv = write(fd, data, len);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0) {
+      // the data is already visible to clients, don't go on without it
+      die("AOF write");
+    }
+    data += rv;
+    len -= (size_t)rv;
+  }
+}
+
+// a record in the request format: [len][nargs][len][arg]...
+static void put_record(std::string &out, const std::string_view *args, uint32_t n) {
+  uint32_t len = 4;
+  for (uint32_t i = 0; i < n; ++i) {
+    len += 4 + (uint32_t)args[i].size();
+  }
+  out.append((char *)&len, 4);
+  out.append((char *)&n, 4);
+  for (uint32_t i = 0; i < n; ++i) {
+    uint32_t sz = (uint32_t)args[i].size();
+    out.append((char *)&sz, 4);
+    out.append(args[i].data(), sz);
+  }
+}
+
+bool aof_enabled() {
+  return g_data.aof.fd >= 0;
+}
+
+// append a write command to the log of this iteration.
+// returns a mark for aof_cancel() in case the command fails.
+size_t aof_log(const std::string_view *args, size_t n) {
+  Aof &aof = g_data.aof;
+  size_t mark = aof.buf.size();
+  if (aof.fd < 0) {
+    return mark;
+  }
+  // a relative ttl would be extended by a replay, log the deadline instead
+  int64_t ttl_ms = -1;
+  if (n == 3 && cmd_is(args[0], "ttl") && str2int(args[2], ttl_ms) && ttl_ms >= 0) {
+    std::string at = std::to_string(get_wall_msec() + (uint64_t)ttl_ms);
+    std::string_view abs[3] = {"pexpireat", args[1], at};
+    put_record(aof.buf, abs, 3);
+    return mark;
+  }
+  // a multi-key write is logged key by key, a replay with another
+  // thread count may put its keys on different shards.
+  if (n >= 3 && n % 2 == 1 && cmd_is(args[0], "mset")) {
+    for (size_t i = 1; i < n; i += 2) {
+      std::string_view one[3] = {"mset", args[i], args[i + 1]};
+      put_record(aof.buf, one, 3);
+    }
+    return mark;
+  }
+  if (n >= 2 && cmd_is(args[0], "mdel")) {
+    for (size_t i = 1; i < n; ++i) {
+      std::string_view one[2] = {"mdel", args[i]};
+      put_record(aof.buf, one, 2);
+    }
+    return mark;
+  }
+  put_record(aof.buf, args, (uint32_t)n);
+  return mark;
+}
+
+void aof_cancel(size_t mark) {
+  g_data.aof.buf.resize(mark);
+}
+
+struct FsyncJob {
+  int fd;
+  std::atomic<bool> *busy;
+};
+
+static void fsync_job(void *arg) {
+  FsyncJob *job = (FsyncJob *)arg;
+  if (fdatasync(job->fd)) {
+    msg("AOF fsync error");
+  }
+  close(job->fd);
+  job->busy->store(false);
+  delete job;
+}
+
+// everysec: at most one fsync in flight, on the bio thread
+static void aof_fsync_bg() {
+  Aof &aof = g_data.aof;
+  uint64_t now_ms = get_monotonic_msec();
+  if (!aof.unsynced || aof.fsync_busy.load()
+    || now_ms < aof.last_fsync_ms + k_fsync_interval_ms)
+  {
+    return;
+  }
+  // a dup, so a rewrite can replace the file in the meantime
+  FsyncJob *job = new FsyncJob{dup(aof.fd), &aof.fsync_busy};
+  if (job->fd < 0) {
+    die("dup");
+  }
+  aof.fsync_busy.store(true);
+  aof.unsynced = false;
+  aof.last_fsync_ms = now_ms;
+  bio_submit(&fsync_job, job);
+}
+
+// write the records of this iteration with a single write(),
+// and with appendfsync always, a single fsync for all of them.
+void aof_flush() {
+  Aof &aof = g_data.aof;
+  if (aof.fd < 0 || aof.buf.empty()) {
+    return;
+  }
+  write_all(aof.fd, aof.buf.data(), aof.buf.size());
+  aof.size += aof.buf.size();
+  if (aof.child > 0) {
+    // the child only sees the data as of the fork
+    aof.rewrite_buf += aof.buf;
+  }
+  aof.buf.clear();
+  aof.unsynced = true;
+
+  switch (g_config.aof_fsync) {
+  case AOF_FSYNC_ALWAYS:
+    if (fdatasync(aof.fd)) {
+      die("AOF fsync");
+    }
+    aof.unsynced = false;
+    break;
+  case AOF_FSYNC_EVERYSEC:
+    aof_fsync_bg();
+    break;
+  }
+}
+
+// with appendfsync always, no response leaves before its records are
+// on disk. anything sent after a write of this iteration is held back.
+bool aof_hold_responses() {
+  Aof &aof = g_data.aof;
+  return aof.fd >= 0 && g_config.aof_fsync == AOF_FSYNC_ALWAYS
+    && !aof.buf.empty();
+}
+
+// when to wake up for the records not written yet, the deferred fsync
+// or the rewrite child.
+uint64_t aof_next_ms() {
+  Aof &aof = g_data.aof;
+  if (!aof.buf.empty()) {
+    // logged by a timer after aof_commit(), like the dels of eviction
+    return get_monotonic_msec();
+  }
+  uint64_t next_ms = (uint64_t)-1;
+  if (aof.unsynced && g_config.aof_fsync == AOF_FSYNC_EVERYSEC) {
+    next_ms = aof.last_fsync_ms + k_fsync_interval_ms;
+  }
+  if (aof.child > 0) {
+    // poll for the child
+    next_ms = min(next_ms, get_monotonic_msec() + 100);
+  }
+  return next_ms;
+}
+
+// dumps the keyspace as the shortest list of records that rebuilds it
+struct Snapshot {
+  int fd = -1;
+  std::string buf;
+};
+
+static void snap_flush(Snapshot &snap) {
+  write_all(snap.fd, snap.buf.data(), snap.buf.size());
+  snap.buf.clear();
+}
+
+static void cb_snapshot(Entry *ent, void *arg) {
+  Snapshot &snap = *(Snapshot *)arg;
+  std::string_view key(entry_key(ent), ent->klen);
+  if (ent->type == T_STR) {
+    uint32_t vlen = 0;
+    const char *val = entry_str(ent, &vlen);
+    std::string_view args[3] = {"set", key, {val, vlen}};
+    put_record(snap.buf, args, 3);
+  } else {
+    // every member from the smallest
+    ZSet *zset = entry_zset(ent);
+    ZNode *znode = zset_query(zset, -INFINITY, "", 0);
+    for (; znode; znode = znode_offset(zset, znode, +1)) {
+      char score[32];
+      int len = snprintf(score, sizeof(score), "%.17g", znode->score);
+      std::string_view args[4] = {"zadd", key, {score, (size_t)len},
+        {znode->name, znode->len}};
+      put_record(snap.buf, args, 4);
+      if (snap.buf.size() >= k_aof_chunk) {
+        snap_flush(snap);
+      }
+    }
+  }
+  int64_t at_ms = entry_expire_at(ent);
+  if (at_ms >= 0) {
+    std::string at = std::to_string(at_ms);
+    std::string_view args[3] = {"pexpireat", key, at};
+    put_record(snap.buf, args, 3);
+  }
+  if (snap.buf.size() >= k_aof_chunk) {
+    snap_flush(snap);
+  }
+}
+
+static void write_snapshot(const std::string &path) {
+  Snapshot snap;
+  snap.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (snap.fd < 0) {
+    die("open AOF rewrite");
+  }
+  db_foreach(&cb_snapshot, &snap);
+  snap_flush(snap);
+  if (fsync(snap.fd)) {
+    die("fsync AOF rewrite");
+  }
+  close(snap.fd);
+}
+
+static void aof_open() {
+  Aof &aof = g_data.aof;
+  aof.fd = open(aof.path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (aof.fd < 0) {
+    die("open AOF");
+  }
+  struct stat st = {};
+  fstat(aof.fd, &st);
+  aof.size = aof.base_size = (uint64_t)st.st_size;
+}
+
+// rewrite in a forked child, which gets a copy-on-write image of the
+// keyspace. returns false if a rewrite is already running.
+bool aof_rewrite_start() {
+  Aof &aof = g_data.aof;
+  if (aof.fd < 0 || aof.child > 0) {
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    msg("fork() error");
+    return false;
+  }
+  if (pid == 0) {
+    // only this thread exists in the child
+    write_snapshot(aof.path + ".rewrite");
+    _exit(0);
+  }
+  aof.child = pid;
+  aof.rewrite_buf.clear();
+  return true;
+}
+
+// add the writes made during the rewrite, then swap the files.
+static void aof_rewrite_done(int status) {
+  Aof &aof = g_data.aof;
+  aof.child = -1;
+  std::string tmp = aof.path + ".rewrite";
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    msg("AOF rewrite failed");
+    unlink(tmp.c_str());
+    aof.rewrite_buf.clear();
+    return;
+  }
+  int fd = open(tmp.c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    die("open AOF rewrite");
+  }
+  write_all(fd, aof.rewrite_buf.data(), aof.rewrite_buf.size());
+  aof.rewrite_buf.clear();
+  aof.rewrite_buf.shrink_to_fit();
+  if (fsync(fd) || rename(tmp.c_str(), aof.path.c_str())) {
+    die("AOF rewrite");
+  }
+  close(aof.fd);
+  aof.fd = fd;
+  aof.unsynced = false;
+  struct stat st = {};
+  fstat(aof.fd, &st);
+  aof.size = aof.base_size = (uint64_t)st.st_size;
+}
+
+// called with the timers
+void aof_cron() {
+  Aof &aof = g_data.aof;
+  if (aof.fd < 0) {
+    return;
+  }
+  if (g_config.aof_fsync == AOF_FSYNC_EVERYSEC) {
+    aof_fsync_bg();
+  }
+  if (aof.child > 0) {
+    int status = 0;
+    if (aof.child == waitpid(aof.child, &status, WNOHANG)) {
+      aof_rewrite_done(status);
+    }
+  } else if (aof.size >= k_rewrite_min_size && aof.size >= 2 * aof.base_size) {
+    (void)aof_rewrite_start();
+  }
+}
+
+// replay a file in large chunks. returns the number of records executed
+// and skipped. an incomplete record at the end of our own file is left
+// over from a crash and is cut off.
+static void aof_load(const std::string &path, bool own,
+  int (*exec)(const uint8_t *, size_t), size_t *applied, size_t *skipped)
+{
+  int fd = open(path.c_str(), own ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    die("open AOF");
+  }
+  Buffer buf;
+  uint64_t offset = 0; // file offset of the first unexecuted record
+  while (true) {
+    buf_reserve(&buf, k_aof_chunk);
+    ssize_t rv = read(fd, buf.data + buf.end, buf_room(&buf));
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0) {
+      die("read AOF");
+    }
+    if (rv == 0) {
+      break;
+    }
+    buf_commit(&buf, (size_t)rv);
+    while (buf_size(&buf) >= 4) {
+      uint32_t len = 0;
+      memcpy(&len, buf_data(&buf), 4);
+      if (4 + (size_t)len > buf_size(&buf)) {
+        buf_reserve(&buf, 4 + (size_t)len); // a record larger than a chunk
+        break;
+      }
+      int ok = exec(buf_data(&buf) + 4, len);
+      if (ok < 0) {
+        fprintf(stderr, "bad AOF record in %s at %lu\n",
+          path.c_str(), (unsigned long)offset);
+        exit(1);
+      }
+      *(ok ? applied : skipped) += 1;
+      buf_consume(&buf, 4 + (size_t)len);
+      offset += 4 + len;
+    }
+  }
+  if (buf_size(&buf) > 0) {
+    fprintf(stderr, "truncating incomplete AOF record in %s at %lu\n",
+      path.c_str(), (unsigned long)offset);
+    if (own && ftruncate(fd, (off_t)offset)) {
+      die("ftruncate AOF");
+    }
+  }
+  buf_free(&buf);
+  close(fd);
+}
+
+// replay the AOF into this shard, then open it for appending.
+// the key to shard mapping depends on the thread count, so every shard
+// reads every file and keeps the keys it owns. if keys moved, the files
+// are rewritten with the new ownership.
+void aof_start(int (*exec)(const uint8_t *, size_t)) {
+  Aof &aof = g_data.aof;
+  uint32_t self = g_data.shard_id;
+  uint32_t nshards = shard_count();
+  aof.path = aof_path(self);
+
+  bool moved = false;
+  slab_bulk_begin();
+  for (uint32_t i = 0; ; ++i) {
+    std::string path = aof_path(i);
+    if (access(path.c_str(), F_OK) != 0) {
+      if (i >= nshards) {
+        break;
+      }
+      continue;
+    }
+    size_t applied = 0, skipped = 0;
+    aof_load(path, i == self, exec, &applied, &skipped);
+    moved = moved || (i == self ? skipped > 0 : applied > 0);
+  }
+  slab_bulk_end();
+
+  // nobody writes a file before every shard has read it
+  shards_barrier();
+  if (moved) {
+    write_snapshot(aof.path + ".rewrite");
+    if (rename((aof.path + ".rewrite").c_str(), aof.path.c_str())) {
+      die("rename AOF");
+    }
+  }
+  shards_barrier();
+  if (self == 0) {
+    // files of shards that no longer exist were taken over
+    for (uint32_t i = nshards; ; ++i) {
+      if (unlink(aof_path(i).c_str())) {
+        break;
+      }
+    }
+  }
+  aof_open();
+  aof.last_fsync_ms = get_monotonic_msec();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum {
+  AOF_FSYNC_ALWAYS = 0, // fsync before the responses are sent
+  AOF_FSYNC_EVERYSEC = 1, // fsync in the background once per second
+  AOF_FSYNC_NO = 2, // leave it to the OS
+};
+
+struct ShardMsg;
+
+// the append-only file of one shard.
+// records use the request format: a 4-byte length, then the args.
+struct Aof {
+  int fd = -1; // -1 if disabled
+  std::string path;
+  // records of the current loop iteration, written by aof_flush()
+  std::string buf;
+  bool unsynced = false; // written but not fsynced yet
+  uint64_t last_fsync_ms = 0;
+  std::atomic<bool> fsync_busy{false};
+  uint64_t size = 0;
+  uint64_t base_size = 0; // size after the last rewrite
+  // background rewrite
+  pid_t child = -1;
+  std::string rewrite_buf; // records written while the child runs
+  // responses held until the records they depend on are fsynced
+  std::vector<int> waiting_fds;
+  std::vector<ShardMsg *> held_msgs;
+};
+
+void aof_start(int (*exec)(const uint8_t *data, size_t len));
+bool aof_enabled();
+size_t aof_log(const std::string_view *args, size_t n);
+void aof_cancel(size_t mark);
+void aof_flush();
+bool aof_hold_responses();
+bool aof_rewrite_start();
+uint64_t aof_next_ms();
+void aof_cron();
@@ -1,153 +1,185 @@
-#include <algorithm>
-#include "avl.h"
-using namespace std;
-
-uint32_t avl_depth(AVLNode *node) {
-    return node ? node->depth : 0;
-}
-
-uint32_t avl_cnt(AVLNode *node) {
-    return node ? node->cnt : 0;
-}
-
-// maintain the depth and cnt field
-static void avl_update(AVLNode *node) {
-    node->depth = 1 + max(avl_depth(node->left), avl_depth(node->right));
-    node->cnt = 1 + avl_cnt(node->left) + avl_cnt(node->right);
-}
-
-static AVLNode *rot_left(AVLNode *node) {
-    AVLNode *new_node = node->right;
-    if (new_node->left) {
-        new_node->left->parent = node;
-    }
-    node->right = new_node->left; // rotation
-    new_node->left = node; // rotation
-    new_node->parent = node->parent;
-    node->parent = new_node;
-    avl_update(node);
-    avl_update(new_node);
-    return new_node;
-}
-
-static AVLNode *rot_right(AVLNode *node) {
-    AVLNode *new_node = node->left;
-    if (new_node->right) {
-        new_node->right->parent = node;
-    }
-    node->left = new_node->right; // rotation
-    new_node->right = node; // rotation
-    new_node->parent = node->parent;
-    node->parent = new_node;
-    avl_update(node);
-    avl_update(new_node);
-    return new_node;
-}
-
-// the left subtree is too deep
-static AVLNode *avl_fix_left(AVLNode *root) {
-    if (avl_depth(root->left->left) < avl_depth(root->left->right)) {
-        root->left = rot_left(root->left); // rule 2
-    }
-    return rot_right(root); // rule 1
-}
-
-static AVLNode *avl_fix_right(AVLNode *root) {
-    if (avl_depth(root->right->right) < avl_depth(root->right->left)) {
-        root->right = rot_right(root->right);
-    }
-
-    return rot_left(root); 
-}
-
-// fix imbalanced nodes and maintain invariants until the root is reached
-AVLNode *avl_fix(AVLNode *node) {
-    while (true) {
-        avl_update(node);
-        uint32_t l = avl_depth(node->left);
-        uint32_t r = avl_depth(node->right);
-        AVLNode **from = NULL;
-        if (AVLNode *p = node->parent) {
-            from = (p->left == node) ? &p->left : &p->right;
-        }
-        if (l == r + 2) {
-            node = avl_fix_left(node);
-        } else if (l + 2 == r) {
-            node = avl_fix_right(node);
-        }
-        if(!from) {
-            return node;
-        }
-        *from = node;
-        node = node->parent;
-    }
-}
-
-// detach a node and returns the new root of the tree
-AVLNode *avl_del(AVLNode *node) {
-    if (node->right == NULL) {
-        // no right subtree, replace the node with the left subtree
-        // link the left subtree to the parent
-        AVLNode *parent = node->parent;
-        if (node->left) {
-            node->left->parent = parent;
-        }
-        if (parent) {
-            // attach the left subtree to the parent
-            (parent->left == node ? parent->left : parent->right) = node->left;
-            return avl_fix(parent);
-        } else {
-            return node->left;
-        }
-    } else {
-        // detach the successor
-        AVLNode *victim = node->right;
-        while (victim->left) {
-            victim = victim->left;
-        }
-        AVLNode *root = avl_del(victim);
-        // swap with it
-        *victim = *node;
-        if (victim->left) {
-            victim->left->parent = victim;
-        }
-        if (victim->right) {
-            victim->right->parent = victim;
-        }
-        if (AVLNode *parent = node->parent) {
-            (parent->left == node ? parent->left : parent->right) = victim;
-            return root;
-        } else {
-            return victim;
-        }
-    }
-}
-
-AVLNode *avl_offset(AVLNode *node, int64_t offset) {
-    int64_t pos = 0;
-    while (offset != pos) {
-        if (pos < offset && pos + avl_cnt(node->right) >= offset) {
-            // target in inside the right subtree
-            node = node->right;
-            pos += avl_cnt(node->left) + 1;
-        } else if (pos > offset && pos - avl_cnt(node->left) <= offset) {
-            // target is inside the left subtree
-            node = node->left;
-            pos -= avl_cnt(node->right) + 1;
-        } else {
-            // go to parent
-            AVLNode *parent = node->parent;
-            if (!parent) {
-                return NULL;
-            }
-            if (parent->right == node) {
-                pos -= avl_cnt(node->left) + 1;
-            } else {
-                pos += avl_cnt(node->right) + 1;
-            }
-            node = parent;
-        }
-    }
-    
-    return node;    
-}
\ No newline at end of file
+#include <algorithm>
+#include "avl.h"
+using namespace std;
+
+uint32_t avl_depth(AVLNode *node) {
+    return node ? node->depth : 0;
+}
+
+uint32_t avl_cnt(AVLNode *node) {
+    return node ? node->cnt : 0;
+}
+
+// maintain the depth and cnt field
+static void avl_update(AVLNode *node) {
+    node->depth = 1 + max(avl_depth(node->left), avl_depth(node->right));
+    node->cnt = 1 + avl_cnt(node->left) + avl_cnt(node->right);
+}
+
+static AVLNode *rot_left(AVLNode *node) {
+    AVLNode *new_node = node->right;
+    if (new_node->left) {
+        new_node->left->parent = node;
+    }
+    node->right = new_node->left; // rotation
+    new_node->left = node; // rotation
+    new_node->parent = node->parent;
+    node->parent = new_node;
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+static AVLNode *rot_right(AVLNode *node) {
+    AVLNode *new_node = node->left;
+    if (new_node->right) {
+        new_node->right->parent = node;
+    }
+    node->left = new_node->right; // rotation
+    new_node->right = node; // rotation
+    new_node->parent = node->parent;
+    node->parent = new_node;
+    avl_update(node);
+    avl_update(new_node);
+    return new_node;
+}
+
+// the left subtree is too deep
+static AVLNode *avl_fix_left(AVLNode *root) {
+    if (avl_depth(root->left->left) < avl_depth(root->left->right)) {
+        root->left = rot_left(root->left); // rule 2
+    }
+    return rot_right(root); // rule 1
+}
+
+static AVLNode *avl_fix_right(AVLNode *root) {
+    if (avl_depth(root->right->right) < avl_depth(root->right->left)) {
+        root->right = rot_right(root->right);
+    }
+
+    return rot_left(root); 
+}
+
+// fix imbalanced nodes and maintain invariants until the root is reached
+AVLNode *avl_fix(AVLNode *node) {
+    while (true) {
+        avl_update(node);
+        uint32_t l = avl_depth(node->left);
+        uint32_t r = avl_depth(node->right);
+        AVLNode **from = NULL;
+        if (AVLNode *p = node->parent) {
+            from = (p->left == node) ? &p->left : &p->right;
+        }
+        if (l == r + 2) {
+            node = avl_fix_left(node);
+        } else if (l + 2 == r) {
+            node = avl_fix_right(node);
+        }
+        if(!from) {
+            return node;
+        }
+        *from = node;
+        node = node->parent;
+    }
+}
+
+// detach a node and returns the new root of the tree
+AVLNode *avl_del(AVLNode *node) {
+    if (node->right == NULL) {
+        // no right subtree, replace the node with the left subtree
+        // link the left subtree to the parent
+        AVLNode *parent = node->parent;
+        if (node->left) {
+            node->left->parent = parent;
+        }
+        if (parent) {
+            // attach the left subtree to the parent
+            (parent->left == node ? parent->left : parent->right) = node->left;
+            return avl_fix(parent);
+        } else {
+            return node->left;
+        }
+    } else {
+        // detach the successor
+        AVLNode *victim = node->right;
+        while (victim->left) {
+            victim = victim->left;
+        }
+        AVLNode *root = avl_del(victim);
+        // swap with it
+        *victim = *node;
+        if (victim->left) {
+            victim->left->parent = victim;
+        }
+        if (victim->right) {
+            victim->right->parent = victim;
+        }
+        if (AVLNode *parent = node->parent) {
+            (parent->left == node ? parent->left : parent->right) = victim;
+            return root;
+        } else {
+            return victim;
+        }
+    }
+}
+
+AVLNode *avl_offset(AVLNode *node, int64_t offset) {
+    int64_t pos = 0;
+    while (offset != pos) {
+        if (pos < offset && pos + avl_cnt(node->right) >= offset) {
+            // target in inside the right subtree
+            node = node->right;
+            pos += avl_cnt(node->left) + 1;
+        } else if (pos > offset && pos - avl_cnt(node->left) <= offset) {
+            // target is inside the left subtree
+            node = node->left;
+            pos -= avl_cnt(node->right) + 1;
+        } else {
+            // go to parent
+            AVLNode *parent = node->parent;
+            if (!parent) {
+                return NULL;
+            }
+            if (parent->right == node) {
+                pos -= avl_cnt(node->left) + 1;
+            } else {
+                pos += avl_cnt(node->right) + 1;
+            }
+            node = parent;
+        }
+    }
+    
+    return node;    
+}
+
+// the position of the node in the sorted order, O(log n)
+int64_t avl_rank(AVLNode *node) {
+    int64_t rank = avl_cnt(node->left);
+    for (; node->parent; node = node->parent) {
+        if (node->parent->right == node) {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+    }
+    return rank;
+}
+
+// build a balanced tree from nodes that are already in order, in O(n).
+// returns the root.
+AVLNode *avl_build(AVLNode **nodes, size_t n) {
+    if (n == 0) {
+        return NULL;
+    }
+    size_t mid = n / 2;
+    AVLNode *root = nodes[mid];
+    root->parent = NULL;
+    root->left = avl_build(nodes, mid);
+    root->right = avl_build(nodes + mid + 1, n - mid - 1);
+    if (root->left) {
+        root->left->parent = root;
+    }
+    if (root->right) {
+        root->right->parent = root;
+    }
+    avl_update(root);
+    return root;
+}
@@ -20,5 +20,7 @@ inline void avl_init(AVLNode *node) {
 uint32_t avl_depth(AVLNode *node);
 uint32_t avl_cnt(AVLNode *node);
 AVLNode *avl_offset(AVLNode *node, int64_t offset);
+int64_t avl_rank(AVLNode *node);
 AVLNode *avl_fix(AVLNode *node);
-AVLNode *avl_del(AVLNode *node);
\ No newline at end of file
+AVLNode *avl_del(AVLNode *node);
+AVLNode *avl_build(AVLNode **nodes, size_t n);
\ No newline at end of file
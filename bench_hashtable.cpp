@@ -0,0 +1,123 @@
+// compares the chained HMap with the SwissMap on string keys.
+// usage: bench_hashtable [nkeys]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "hashtable.h"
+#include "swisstable.h"
+
+// a key can be in both kinds of tables
+struct Key {
+  HNode hnode;
+  SNode snode;
+  std::string name;
+};
+
+static bool hkey_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, Key, hnode)->name == container_of(rhs, Key, hnode)->name;
+}
+
+static bool skey_eq(SNode *lhs, SNode *rhs) {
+  return container_of(lhs, Key, snode)->name == container_of(rhs, Key, snode)->name;
+}
+
+static uint64_t now_ns() {
+  timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+struct HMapOps {
+  HMap map;
+  void insert(Key *key) { hm_insert(&map, &key->hnode); }
+  bool lookup(Key *key) { return hm_lookup(&map, &key->hnode, &hkey_eq); }
+  bool pop(Key *key) { return hm_pop(&map, &key->hnode, &hkey_eq); }
+  void destroy() { hm_destroy(&map); }
+};
+
+struct SwissOps {
+  SwissMap map;
+  void insert(Key *key) { sm_insert(&map, &key->snode); }
+  bool lookup(Key *key) { return sm_lookup(&map, &key->snode, &skey_eq); }
+  bool pop(Key *key) { return sm_pop(&map, &key->snode, &skey_eq); }
+  void destroy() { sm_destroy(&map); }
+};
+
+static void report(const char *name, const char *op, uint64_t ns, size_t n,
+  uint64_t max_ns)
+{
+  printf("%-6s %-12s %8.1f ns/op   max %8.1f us\n",
+    name, op, (double)ns / n, (double)max_ns / 1000);
+}
+
+template <class Ops>
+static void bench(const char *name, std::vector<Key> &keys,
+  std::vector<Key> &misses)
+{
+  Ops ops;
+  size_t n = keys.size();
+  // insert, with the worst single insert to show rehash stalls
+  uint64_t max_ns = 0;
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t t = now_ns();
+    ops.insert(&keys[i]);
+    max_ns = max(max_ns, now_ns() - t);
+  }
+  report(name, "insert", now_ns() - t0, n, max_ns);
+
+  // lookups in a random order
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  for (size_t i = n; i > 1; --i) {
+    std::swap(order[i - 1], order[(size_t)rand() % i]);
+  }
+  size_t found = 0;
+  t0 = now_ns();
+  for (size_t i : order) {
+    found += ops.lookup(&keys[i]);
+  }
+  report(name, "lookup hit", now_ns() - t0, n, 0);
+  t0 = now_ns();
+  for (Key &key : misses) {
+    found += ops.lookup(&key);
+  }
+  report(name, "lookup miss", now_ns() - t0, misses.size(), 0);
+  if (found != n) {
+    die("bad lookup");
+  }
+
+  t0 = now_ns();
+  for (size_t i : order) {
+    if (!ops.pop(&keys[i])) {
+      die("bad pop");
+    }
+  }
+  report(name, "delete", now_ns() - t0, n, 0);
+  ops.destroy();
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+  std::vector<Key> keys(n), misses(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i].name = "key:" + std::to_string(i);
+    misses[i].name = "miss:" + std::to_string(i);
+  }
+  for (std::vector<Key> *v : {&keys, &misses}) {
+    for (Key &key : *v) {
+      key.hnode.hcode = str_hash((uint8_t *)key.name.data(), key.name.size());
+      key.snode.hcode = key.hnode.hcode;
+    }
+  }
+  printf("%zu keys\n", n);
+  bench<HMapOps>("hmap", keys, misses);
+  bench<SwissOps>("swiss", keys, misses);
+  return 0;
+}
@@ -0,0 +1,318 @@
+// micro-benchmarks of the data structures over a range of sizes, for
+// comparing builds. the output is CSV, one line per operation and size:
+//   bench,op,n,ns_per_op,p99_ns,p999_ns,max_ns
+// the percentiles are only measured where a single call can stall, like
+// the inserts of a hashtable during a resize, and in a pass of their own
+// so ns_per_op has no clock reads in it. they are within 1%, and 0 for
+// the other operations.
+// sizes go from 1K up to `max_n` by 10x. a small size is repeated so
+// every line is at least about 1M operations.
+// usage: bench_suite [max_n] [filter]
+//   max_n: 1000000 by default, 100000000 takes tens of GB.
+//   filter: only the benchmarks with this name, like hmap or zset.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "common.h"
+#include "avl.h"
+#include "hashtable.h"
+#include "hdr.h"
+#include "heap.h"
+#include "swisstable.h"
+#include "zset.h"
+
+static uint64_t now_ns() {
+  timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// the total time of an operation over all the rounds, and the
+// latency of single calls if they are timed.
+struct Meas {
+  uint64_t ns = 0;
+  uint64_t ops = 0;
+  Hdr calls;
+};
+
+static void report(const char *bench, const char *op, size_t n, const Meas &m) {
+  printf("%s,%s,%zu,%.2f,%llu,%llu,%llu\n", bench, op, n,
+    (double)m.ns / (double)m.ops,
+    (unsigned long long)hdr_quantile(m.calls, 0.99),
+    (unsigned long long)hdr_quantile(m.calls, 0.999),
+    (unsigned long long)m.calls.max);
+  fflush(stdout);
+}
+
+static std::mt19937_64 g_rng(1);
+
+// a random permutation of [0, n)
+static std::vector<uint64_t> shuffled(size_t n) {
+  std::vector<uint64_t> v(n);
+  for (size_t i = 0; i < n; ++i) {
+    v[i] = i;
+  }
+  std::shuffle(v.begin(), v.end(), g_rng);
+  return v;
+}
+
+static uint64_t id_hash(uint64_t id) {
+  return str_hash((const uint8_t *)&id, sizeof(id));
+}
+
+// hashtables: integer keys, so the time is in the table, not in
+// comparing strings. every insert is timed to show the resize stalls.
+struct HKey {
+  HNode hnode;
+  SNode snode;
+  uint64_t id = 0;
+};
+
+static bool hkey_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, HKey, hnode)->id == container_of(rhs, HKey, hnode)->id;
+}
+
+static bool skey_eq(SNode *lhs, SNode *rhs) {
+  return container_of(lhs, HKey, snode)->id == container_of(rhs, HKey, snode)->id;
+}
+
+struct HMapOps {
+  HMap map;
+  void insert(HKey *key) { hm_insert(&map, &key->hnode); }
+  bool lookup(HKey *key) { return hm_lookup(&map, &key->hnode, &hkey_eq); }
+  bool pop(HKey *key) { return hm_pop(&map, &key->hnode, &hkey_eq); }
+  void destroy() { hm_destroy(&map); }
+};
+
+struct SwissOps {
+  SwissMap map;
+  void insert(HKey *key) { sm_insert(&map, &key->snode); }
+  bool lookup(HKey *key) { return sm_lookup(&map, &key->snode, &skey_eq); }
+  bool pop(HKey *key) { return sm_pop(&map, &key->snode, &skey_eq); }
+  void destroy() { sm_destroy(&map); }
+};
+
+template <class Ops>
+static void bench_table(const char *name, size_t n, size_t rounds) {
+  std::vector<HKey> keys(n), misses(n);
+  for (size_t i = 0; i < n; ++i) {
+    keys[i].id = i;
+    misses[i].id = n + i;
+    for (HKey *key : {&keys[i], &misses[i]}) {
+      key->hnode.hcode = key->snode.hcode = id_hash(key->id);
+    }
+  }
+  std::vector<uint64_t> order = shuffled(n);
+  Meas insert, hit, miss, pop;
+  size_t found = 0;
+  for (size_t r = 0; r < rounds; ++r) {
+    Ops ops;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      ops.insert(&keys[i]);
+    }
+    insert.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    for (uint64_t i : order) {
+      found += ops.lookup(&keys[i]);
+    }
+    hit.ns += now_ns() - t0;
+    t0 = now_ns();
+    for (uint64_t i : order) {
+      found += ops.lookup(&misses[i]);
+    }
+    miss.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    for (uint64_t i : order) {
+      found -= ops.pop(&keys[i]);
+    }
+    pop.ns += now_ns() - t0;
+    ops.destroy();
+
+    // every insert again, one at a time for the percentiles. the clock
+    // reads would add to ns_per_op if the first pass was timed this way.
+    Ops timed;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t t = now_ns();
+      timed.insert(&keys[i]);
+      hdr_add(&insert.calls, now_ns() - t);
+    }
+    timed.destroy();
+  }
+  if (found != 0) {
+    die("bad lookup");
+  }
+  insert.ops = hit.ops = miss.ops = pop.ops = n * rounds;
+  report(name, "insert", n, insert);
+  report(name, "lookup_hit", n, hit);
+  report(name, "lookup_miss", n, miss);
+  report(name, "pop", n, pop);
+}
+
+// zsets: 8-byte names and random scores in the tree encoding
+static void bench_zset(const char *name, int index, size_t n, size_t rounds) {
+  g_zset_index = index;
+  g_zset_pack_max_n = 0;
+  std::vector<uint64_t> ids = shuffled(n);
+  std::vector<double> scores(n);
+  for (size_t i = 0; i < n; ++i) {
+    scores[i] = (double)(g_rng() % (n * 10));
+  }
+  size_t nq = n < 100000 ? n : 100000; // queries per round
+  Meas add, query, offset, rem;
+  uint64_t seen = 0;
+  for (size_t r = 0; r < rounds; ++r) {
+    ZSet zset;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      zset_add(&zset, (const char *)&ids[i], sizeof(ids[i]), scores[i]);
+    }
+    add.ns += now_ns() - t0;
+
+    // seek by score
+    t0 = now_ns();
+    for (size_t i = 0; i < nq; ++i) {
+      ZNode *node = zset_query(&zset, scores[g_rng() % n], "", 0);
+      seen += node ? node->len : 0;
+    }
+    query.ns += now_ns() - t0;
+
+    // move a random distance from the first member
+    ZNode *first = zset_query(&zset, -1e300, "", 0);
+    t0 = now_ns();
+    for (size_t i = 0; i < nq; ++i) {
+      seen += znode_offset(&zset, first, (int64_t)(g_rng() % n))->len;
+    }
+    offset.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      znode_del(zset_pop(&zset, (const char *)&ids[i], sizeof(ids[i])));
+    }
+    rem.ns += now_ns() - t0;
+    zset_dispose(&zset);
+  }
+  if (seen == 0) {
+    die("bad query");
+  }
+  add.ops = rem.ops = n * rounds;
+  query.ops = offset.ops = nq * rounds;
+  report(name, "zset_add", n, add);
+  report(name, "zset_query", n, query);
+  report(name, "znode_offset", n, offset);
+  report(name, "zset_pop", n, rem);
+}
+
+// a bare AVL tree: descend and avl_fix() to insert, avl_del() in a
+// random order to delete.
+struct ANode {
+  AVLNode node;
+  uint64_t val = 0;
+};
+
+static void bench_avl(size_t n, size_t rounds) {
+  std::vector<ANode> nodes(n);
+  std::vector<uint64_t> order = shuffled(n);
+  for (size_t i = 0; i < n; ++i) {
+    nodes[i].val = order[i];
+  }
+  order = shuffled(n);
+  Meas fix, del;
+  for (size_t r = 0; r < rounds; ++r) {
+    AVLNode *root = NULL;
+    uint64_t t0 = now_ns();
+    for (ANode &data : nodes) {
+      avl_init(&data.node);
+      AVLNode *cur = NULL;
+      AVLNode **from = &root;
+      while (*from) {
+        cur = *from;
+        from = data.val < container_of(cur, ANode, node)->val ? &cur->left : &cur->right;
+      }
+      *from = &data.node;
+      data.node.parent = cur;
+      root = avl_fix(&data.node);
+    }
+    fix.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    for (uint64_t i : order) {
+      root = avl_del(&nodes[i].node);
+    }
+    del.ns += now_ns() - t0;
+    if (root) {
+      die("bad avl_del");
+    }
+  }
+  fix.ops = del.ops = n * rounds;
+  report("avl", "insert_fix", n, fix);
+  report("avl", "avl_del", n, del);
+}
+
+// a binary heap of timers: change random ones and heap_update() them
+static void bench_heap(size_t n, size_t rounds) {
+  std::vector<size_t> refs(n, (size_t)-1);
+  Meas upsert, update, del;
+  for (size_t r = 0; r < rounds; ++r) {
+    std::vector<HeapItem> heap;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      heap_upsert(heap, (size_t)-1, HeapItem{g_rng() % (n * 10), &refs[i]});
+    }
+    upsert.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+      size_t pos = refs[g_rng() % n];
+      heap[pos].val = g_rng() % (n * 10);
+      heap_update(heap.data(), pos, heap.size());
+    }
+    update.ns += now_ns() - t0;
+
+    t0 = now_ns();
+    while (!heap.empty()) {
+      heap_delete(heap, 0);
+    }
+    del.ns += now_ns() - t0;
+  }
+  upsert.ops = update.ops = del.ops = n * rounds;
+  report("heap", "heap_upsert", n, upsert);
+  report("heap", "heap_update", n, update);
+  report("heap", "heap_delete_min", n, del);
+}
+
+int main(int argc, char **argv) {
+  size_t max_n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+  auto want = [&](const char *name) {
+    return !filter || 0 == strcmp(filter, name);
+  };
+  printf("bench,op,n,ns_per_op,p99_ns,p999_ns,max_ns\n");
+  for (size_t n = 1000; n <= max_n; n *= 10) {
+    size_t rounds = n < 1000000 ? 1000000 / n : 1;
+    if (want("hmap")) {
+      bench_table<HMapOps>("hmap", n, rounds);
+    }
+    if (want("swiss")) {
+      bench_table<SwissOps>("swiss", n, rounds);
+    }
+    if (want("zset")) {
+      bench_zset("zset_avl", ZINDEX_AVL, n, rounds);
+      bench_zset("zset_btree", ZINDEX_BTREE, n, rounds);
+    }
+    if (want("avl")) {
+      bench_avl(n, rounds);
+    }
+    if (want("heap")) {
+      bench_heap(n, rounds);
+    }
+  }
+  return 0;
+}
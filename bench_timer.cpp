@@ -0,0 +1,124 @@
+// compares the binary heap and the timing wheel as ttl timers.
+// the timers are embedded in objects visited in random order, like
+// the entries of a large db.
+// usage: bench_timer [ntimers]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "common.h"
+#include "heap.h"
+#include "timewheel.h"
+
+static uint64_t now_ns() {
+  timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static void report(const char *name, const char *op, uint64_t ns, size_t n) {
+  printf("%-6s %-8s %8.1f ns/op\n", name, op, (double)ns / n);
+}
+
+// about the size of a small entry
+struct HeapObj {
+  size_t heap_idx = (size_t)-1;
+  char key[40];
+};
+
+struct WheelObj {
+  TWTimer timer;
+  char key[40];
+};
+
+// ttls from 1s to 1h, in ms
+static std::vector<uint64_t> g_ttls;
+static std::vector<size_t> g_order;
+
+const uint64_t k_step_ms = 100; // how far a loop iteration moves the clock
+
+static void bench_heap(size_t n) {
+  std::vector<HeapObj> objs(n);
+  std::vector<HeapItem> heap;
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    HeapObj &obj = objs[g_order[i]];
+    heap_upsert(heap, obj.heap_idx, HeapItem{g_ttls[i], &obj.heap_idx});
+  }
+  report("heap", "arm", now_ns() - t0, n);
+
+  t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    HeapObj &obj = objs[g_order[n - 1 - i]];
+    heap_upsert(heap, obj.heap_idx, HeapItem{g_ttls[i] + 1000, &obj.heap_idx});
+  }
+  report("heap", "re-arm", now_ns() - t0, n);
+
+  t0 = now_ns();
+  for (size_t i = 0; i < n / 2; ++i) {
+    HeapObj &obj = objs[g_order[i]];
+    heap_delete(heap, obj.heap_idx);
+    obj.heap_idx = (size_t)-1;
+  }
+  report("heap", "cancel", now_ns() - t0, n / 2);
+
+  size_t left = heap.size();
+  t0 = now_ns();
+  for (uint64_t now = 0; !heap.empty(); now += k_step_ms) {
+    while (!heap.empty() && heap[0].val < now) {
+      *heap[0].ref = (size_t)-1;
+      heap_delete(heap, 0);
+    }
+  }
+  report("heap", "expire", now_ns() - t0, left);
+}
+
+static void bench_wheel(size_t n) {
+  std::vector<WheelObj> objs(n);
+  TWheel *tw = new TWheel();
+  tw_init(tw, 0);
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    tw_add(tw, &objs[g_order[i]].timer, g_ttls[i]);
+  }
+  report("wheel", "arm", now_ns() - t0, n);
+
+  t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    tw_add(tw, &objs[g_order[n - 1 - i]].timer, g_ttls[i] + 1000);
+  }
+  report("wheel", "re-arm", now_ns() - t0, n);
+
+  t0 = now_ns();
+  for (size_t i = 0; i < n / 2; ++i) {
+    tw_del(tw, &objs[g_order[i]].timer);
+  }
+  report("wheel", "cancel", now_ns() - t0, n / 2);
+
+  size_t left = tw->size;
+  t0 = now_ns();
+  for (uint64_t now = 0; tw->size > 0; now += k_step_ms) {
+    while (tw_pop(tw, now)) {}
+  }
+  report("wheel", "expire", now_ns() - t0, left);
+  delete tw;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 10000000;
+  std::mt19937_64 rng(1);
+  g_ttls.resize(n);
+  g_order.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    g_ttls[i] = 1000 + rng() % (3600 * 1000);
+    g_order[i] = i;
+  }
+  std::shuffle(g_order.begin(), g_order.end(), rng);
+  printf("%zu timers\n", n);
+  bench_heap(n);
+  bench_wheel(n);
+  return 0;
+}
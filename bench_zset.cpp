@@ -0,0 +1,99 @@
+// compares the AVL and the B+tree zset indexes.
+// usage: bench_zset [nmembers]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "zset.h"
+
+static uint64_t now_ns() {
+  timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static void report(const char *name, const char *op, uint64_t ns, size_t n) {
+  printf("%-6s %-14s %8.1f ns/op\n", name, op, (double)ns / n);
+}
+
+const size_t k_range = 10; // members per range query
+
+static void bench(const char *name, int index, std::vector<std::string> &names,
+  std::vector<double> &scores)
+{
+  g_zset_index = index;
+  ZSet zset;
+  size_t n = names.size();
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    zset_add(&zset, names[i].data(), names[i].size(), scores[i]);
+  }
+  report(name, "zadd", now_ns() - t0, n);
+
+  // seek to a random score, then read the next few members
+  size_t nq = n / 10 + 1;
+  size_t seen = 0;
+  t0 = now_ns();
+  for (size_t i = 0; i < nq; ++i) {
+    ZNode *node = zset_query(&zset, scores[(size_t)rand() % n], "", 0);
+    for (size_t j = 0; node && j < k_range; ++j) {
+      seen += node->len;
+      node = znode_offset(&zset, node, +1);
+    }
+  }
+  report(name, "zquery+10", now_ns() - t0, nq);
+
+  // rank of a member by name
+  int64_t total = 0;
+  t0 = now_ns();
+  for (size_t i = 0; i < nq; ++i) {
+    const std::string &s = names[(size_t)rand() % n];
+    total += zset_rank(&zset, zset_lookup(&zset, s.data(), s.size()));
+  }
+  report(name, "zrank", now_ns() - t0, nq);
+
+  // member by rank
+  ZNode *first = zset_query(&zset, -1e300, "", 0);
+  t0 = now_ns();
+  for (size_t i = 0; i < nq; ++i) {
+    seen += znode_offset(&zset, first, (int64_t)((size_t)rand() % n))->len;
+  }
+  report(name, "offset", now_ns() - t0, nq);
+
+  // a full scan in order
+  t0 = now_ns();
+  for (ZNode *node = first; node; node = znode_offset(&zset, node, +1)) {
+    seen++;
+  }
+  report(name, "scan", now_ns() - t0, n);
+
+  t0 = now_ns();
+  for (size_t i = 0; i < n; ++i) {
+    ZNode *node = zset_pop(&zset, names[i].data(), names[i].size());
+    znode_del(node);
+  }
+  report(name, "zrem", now_ns() - t0, n);
+  zset_dispose(&zset);
+  if (seen == 0 || total < 0) {
+    die("bad result");
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? (size_t)atoll(argv[1]) : 1000000;
+  std::vector<std::string> names(n);
+  std::vector<double> scores(n);
+  for (size_t i = 0; i < n; ++i) {
+    names[i] = "member:" + std::to_string(i);
+    scores[i] = (double)(rand() % 1000000);
+  }
+  // only the tree encoding
+  g_zset_pack_max_n = 0;
+  printf("%zu members\n", n);
+  bench("avl", ZINDEX_AVL, names, scores);
+  bench("btree", ZINDEX_BTREE, names, scores);
+  return 0;
+}
@@ -0,0 +1,50 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "bio.h"
+
+struct BioJob {
+  void (*fn)(void *) = NULL;
+  void *arg = NULL;
+};
+
+static struct {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<BioJob> jobs;
+  size_t pending = 0; // queued or running
+  bool started = false;
+} g_bio;
+
+static void bio_worker() {
+  while (true) {
+    BioJob job;
+    {
+      std::unique_lock<std::mutex> lock(g_bio.mu);
+      g_bio.cv.wait(lock, [] { return !g_bio.jobs.empty(); });
+      job = g_bio.jobs.front();
+      g_bio.jobs.pop_front();
+    }
+    job.fn(job.arg);
+    std::lock_guard<std::mutex> lock(g_bio.mu);
+    g_bio.pending--;
+  }
+}
+
+void bio_submit(void (*fn)(void *), void *arg) {
+  std::lock_guard<std::mutex> lock(g_bio.mu);
+  if (!g_bio.started) {
+    // started on first use
+    std::thread(bio_worker).detach();
+    g_bio.started = true;
+  }
+  g_bio.jobs.push_back(BioJob{fn, arg});
+  g_bio.pending++;
+  g_bio.cv.notify_one();
+}
+
+size_t bio_pending() {
+  std::lock_guard<std::mutex> lock(g_bio.mu);
+  return g_bio.pending;
+}
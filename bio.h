@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+
+// background jobs that must not block the event loop.
+// jobs run in submission order on a single worker thread.
+void bio_submit(void (*fn)(void *), void *arg);
+size_t bio_pending();
@@ -0,0 +1,472 @@
+#include <assert.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include "common.h"
+#include "btree.h"
+#include "slab.h"
+#include "zset.h"
+
+// a node is split once it has this many entries
+const uint32_t k_bt_cap = 48;
+// nodes below this are merged with a sibling if they fit
+const uint32_t k_bt_min = k_bt_cap / 4;
+// bulk loading leaves room for inserts
+const uint32_t k_bt_fill = k_bt_cap * 3 / 4;
+const uint32_t k_bt_max_depth = 32;
+
+struct BTNode {
+    uint32_t n = 0;
+    bool leaf = true;
+    // leaf: the members in order. inner: the smallest member of each child.
+    // the scores are copied out so a search mostly reads this array.
+    double scores[k_bt_cap];
+    ZNode *keys[k_bt_cap];
+};
+
+struct BTLeaf {
+    BTNode base;
+    BTLeaf *prev = NULL;
+    BTLeaf *next = NULL;
+};
+
+struct BTInner {
+    BTNode base;
+    BTNode *kids[k_bt_cap];
+    size_t cnt[k_bt_cap]; // subtree sizes
+};
+
+static BTLeaf *as_leaf(BTNode *node) {
+    return container_of(node, BTLeaf, base);
+}
+
+static BTInner *as_inner(BTNode *node) {
+    return container_of(node, BTInner, base);
+}
+
+static BTLeaf *leaf_new() {
+    return new (slab_alloc(sizeof(BTLeaf))) BTLeaf();
+}
+
+static BTInner *inner_new() {
+    BTInner *inner = new (slab_alloc(sizeof(BTInner))) BTInner();
+    inner->base.leaf = false;
+    return inner;
+}
+
+static void node_free(BTNode *node) {
+    if (node->leaf) {
+        BTLeaf *leaf = as_leaf(node);
+        if (leaf->prev) {
+            leaf->prev->next = leaf->next;
+        }
+        if (leaf->next) {
+            leaf->next->prev = leaf->prev;
+        }
+        slab_free(leaf, sizeof(BTLeaf));
+    } else {
+        slab_free(as_inner(node), sizeof(BTInner));
+    }
+}
+
+static size_t node_count(BTNode *node) {
+    if (node->leaf) {
+        return node->n;
+    }
+    size_t total = 0;
+    for (uint32_t i = 0; i < node->n; ++i) {
+        total += as_inner(node)->cnt[i];
+    }
+    return total;
+}
+
+// compare the i-th key of the node with (score, name)
+static int key_cmp(BTNode *node, uint32_t i, double score, const char *name, size_t len) {
+    if (node->scores[i] != score) {
+        return node->scores[i] < score ? -1 : 1;
+    }
+    ZNode *key = node->keys[i];
+    int rv = memcmp(key->name, name, min(key->len, len));
+    if (rv != 0) {
+        return rv;
+    }
+    return key->len < len ? -1 : (key->len > len ? 1 : 0);
+}
+
+// the first position whose key is >= (score, name), or > with `upper`
+static uint32_t node_search(BTNode *node, double score, const char *name,
+    size_t len, bool upper)
+{
+    uint32_t lo = 0, hi = node->n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        int rv = key_cmp(node, mid, score, name, len);
+        if (rv < 0 || (upper && rv == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// the child that holds (score, name): the last one whose smallest key
+// is not greater than it
+static uint32_t child_for(BTNode *node, double score, const char *name, size_t len) {
+    uint32_t i = node_search(node, score, name, len, true);
+    return i ? i - 1 : 0;
+}
+
+// the inner nodes from the root to a leaf, and the child taken in each
+struct BTPath {
+    BTInner *nodes[k_bt_max_depth];
+    uint32_t idx[k_bt_max_depth];
+    uint32_t depth = 0;
+};
+
+static BTLeaf *descend(BTree *tree, double score, const char *name, size_t len,
+    BTPath *path)
+{
+    BTNode *node = tree->root;
+    while (!node->leaf) {
+        uint32_t i = child_for(node, score, name, len);
+        if (path) {
+            assert(path->depth < k_bt_max_depth);
+            path->nodes[path->depth] = as_inner(node);
+            path->idx[path->depth] = i;
+            path->depth++;
+        }
+        node = as_inner(node)->kids[i];
+    }
+    return as_leaf(node);
+}
+
+static void key_insert(BTNode *node, uint32_t i, double score, ZNode *key) {
+    memmove(&node->scores[i + 1], &node->scores[i], (node->n - i) * sizeof(double));
+    memmove(&node->keys[i + 1], &node->keys[i], (node->n - i) * sizeof(ZNode *));
+    node->scores[i] = score;
+    node->keys[i] = key;
+    node->n++;
+}
+
+static void key_remove(BTNode *node, uint32_t i) {
+    memmove(&node->scores[i], &node->scores[i + 1], (node->n - i - 1) * sizeof(double));
+    memmove(&node->keys[i], &node->keys[i + 1], (node->n - i - 1) * sizeof(ZNode *));
+    node->n--;
+}
+
+// the i-th key of the parent is the smallest key of its child
+static void key_update(BTNode *parent, uint32_t i, BTNode *child) {
+    parent->scores[i] = child->scores[0];
+    parent->keys[i] = child->keys[0];
+}
+
+static void kid_insert(BTInner *inner, uint32_t i, BTNode *kid, size_t cnt) {
+    uint32_t n = inner->base.n;
+    memmove(&inner->kids[i + 1], &inner->kids[i], (n - i) * sizeof(BTNode *));
+    memmove(&inner->cnt[i + 1], &inner->cnt[i], (n - i) * sizeof(size_t));
+    inner->kids[i] = kid;
+    inner->cnt[i] = cnt;
+    key_insert(&inner->base, i, kid->scores[0], kid->keys[0]);
+}
+
+static void kid_remove(BTInner *inner, uint32_t i) {
+    uint32_t n = inner->base.n;
+    memmove(&inner->kids[i], &inner->kids[i + 1], (n - i - 1) * sizeof(BTNode *));
+    memmove(&inner->cnt[i], &inner->cnt[i + 1], (n - i - 1) * sizeof(size_t));
+    key_remove(&inner->base, i);
+}
+
+// move the upper half into a new right sibling
+static BTNode *node_split(BTNode *node) {
+    uint32_t half = node->n / 2;
+    uint32_t moved = node->n - half;
+    BTNode *right = NULL;
+    if (node->leaf) {
+        BTLeaf *left = as_leaf(node);
+        BTLeaf *leaf = leaf_new();
+        leaf->prev = left;
+        leaf->next = left->next;
+        if (leaf->next) {
+            leaf->next->prev = leaf;
+        }
+        left->next = leaf;
+        right = &leaf->base;
+    } else {
+        BTInner *inner = inner_new();
+        memcpy(inner->kids, &as_inner(node)->kids[half], moved * sizeof(BTNode *));
+        memcpy(inner->cnt, &as_inner(node)->cnt[half], moved * sizeof(size_t));
+        right = &inner->base;
+    }
+    memcpy(right->scores, &node->scores[half], moved * sizeof(double));
+    memcpy(right->keys, &node->keys[half], moved * sizeof(ZNode *));
+    right->n = moved;
+    node->n = half;
+    return right;
+}
+
+// merge the (i+1)-th child into the i-th one if they fit in a node
+static void node_merge(BTInner *parent, uint32_t i) {
+    BTNode *left = parent->kids[i];
+    BTNode *right = parent->kids[i + 1];
+    if (left->n + right->n >= k_bt_cap) {
+        return;
+    }
+    if (!left->leaf) {
+        memcpy(&as_inner(left)->kids[left->n], as_inner(right)->kids, right->n * sizeof(BTNode *));
+        memcpy(&as_inner(left)->cnt[left->n], as_inner(right)->cnt, right->n * sizeof(size_t));
+    }
+    memcpy(&left->scores[left->n], right->scores, right->n * sizeof(double));
+    memcpy(&left->keys[left->n], right->keys, right->n * sizeof(ZNode *));
+    left->n += right->n;
+    parent->cnt[i] += parent->cnt[i + 1];
+    kid_remove(parent, i + 1);
+    node_free(right);
+}
+
+void bt_insert(BTree *tree, ZNode *znode) {
+    tree->hint_leaf = NULL;
+    if (!tree->root) {
+        tree->root = &leaf_new()->base;
+    }
+    BTPath path;
+    BTNode *node = &descend(tree, znode->score, znode->name, znode->len, &path)->base;
+    uint32_t pos = node_search(node, znode->score, znode->name, znode->len, false);
+    key_insert(node, pos, znode->score, znode);
+    // fix the counts and the smallest keys up to the root, split full nodes
+    for (uint32_t d = path.depth; d-- > 0;) {
+        BTInner *parent = path.nodes[d];
+        uint32_t i = path.idx[d];
+        parent->cnt[i]++;
+        key_update(&parent->base, i, node);
+        if (node->n == k_bt_cap) {
+            BTNode *right = node_split(node);
+            size_t cnt = node_count(right);
+            parent->cnt[i] -= cnt;
+            kid_insert(parent, i + 1, right, cnt);
+        }
+        node = &parent->base;
+    }
+    if (node->n == k_bt_cap) {
+        // the root is full, the tree grows by a level
+        BTNode *right = node_split(node);
+        BTInner *root = inner_new();
+        kid_insert(root, 0, node, node_count(node));
+        kid_insert(root, 1, right, node_count(right));
+        tree->root = &root->base;
+    }
+}
+
+void bt_erase(BTree *tree, ZNode *znode) {
+    tree->hint_leaf = NULL;
+    BTPath path;
+    BTNode *node = &descend(tree, znode->score, znode->name, znode->len, &path)->base;
+    uint32_t pos = node_search(node, znode->score, znode->name, znode->len, false);
+    assert(pos < node->n && node->keys[pos] == znode);
+    key_remove(node, pos);
+    // empty nodes are removed, small ones merged with a sibling
+    for (uint32_t d = path.depth; d-- > 0;) {
+        BTInner *parent = path.nodes[d];
+        uint32_t i = path.idx[d];
+        parent->cnt[i]--;
+        if (node->n == 0) {
+            kid_remove(parent, i);
+            node_free(node);
+        } else {
+            key_update(&parent->base, i, node);
+            if (node->n < k_bt_min && parent->base.n > 1) {
+                node_merge(parent, i + 1 < parent->base.n ? i : i - 1);
+            }
+        }
+        node = &parent->base;
+    }
+    // node is the root
+    if (node->n == 0) {
+        node_free(node);
+        tree->root = NULL;
+    }
+    while (tree->root && !tree->root->leaf && tree->root->n == 1) {
+        BTNode *root = tree->root;
+        tree->root = as_inner(root)->kids[0];
+        node_free(root);
+    }
+}
+
+// bulk load members in (score, name) order, O(n)
+void bt_build(BTree *tree, ZNode **nodes, size_t n) {
+    assert(!tree->root);
+    if (n == 0) {
+        return;
+    }
+    std::vector<BTNode *> level;
+    std::vector<size_t> counts;
+    size_t nleaves = (n + k_bt_fill - 1) / k_bt_fill;
+    BTLeaf *prev = NULL;
+    for (size_t i = 0, start = 0; i < nleaves; ++i) {
+        size_t end = n * (i + 1) / nleaves;
+        BTLeaf *leaf = leaf_new();
+        leaf->prev = prev;
+        if (prev) {
+            prev->next = leaf;
+        }
+        for (size_t j = start; j < end; ++j) {
+            BTNode *node = &leaf->base;
+            node->scores[node->n] = nodes[j]->score;
+            node->keys[node->n++] = nodes[j];
+        }
+        level.push_back(&leaf->base);
+        counts.push_back(end - start);
+        prev = leaf;
+        start = end;
+    }
+    while (level.size() > 1) {
+        size_t m = level.size();
+        size_t nparents = (m + k_bt_fill - 1) / k_bt_fill;
+        std::vector<BTNode *> up;
+        std::vector<size_t> up_counts;
+        for (size_t i = 0, start = 0; i < nparents; ++i) {
+            size_t end = m * (i + 1) / nparents;
+            BTInner *inner = inner_new();
+            size_t total = 0;
+            for (size_t j = start; j < end; ++j) {
+                kid_insert(inner, inner->base.n, level[j], counts[j]);
+                total += counts[j];
+            }
+            up.push_back(&inner->base);
+            up_counts.push_back(total);
+            start = end;
+        }
+        level.swap(up);
+        counts.swap(up_counts);
+    }
+    tree->root = level[0];
+}
+
+static void node_dispose(BTNode *node, void (*f)(ZNode *)) {
+    for (uint32_t i = 0; i < node->n; ++i) {
+        if (node->leaf) {
+            f(node->keys[i]);
+        } else {
+            node_dispose(as_inner(node)->kids[i], f);
+        }
+    }
+    if (node->leaf) {
+        slab_free(as_leaf(node), sizeof(BTLeaf));
+    } else {
+        slab_free(as_inner(node), sizeof(BTInner));
+    }
+}
+
+// free the tree, calling f() on every member
+void bt_dispose(BTree *tree, void (*f)(ZNode *)) {
+    if (tree->root) {
+        node_dispose(tree->root, f);
+    }
+    *tree = BTree{};
+}
+
+size_t bt_size(BTree *tree) {
+    return tree->root ? node_count(tree->root) : 0;
+}
+
+static ZNode *hint_set(BTree *tree, BTLeaf *leaf, uint32_t pos) {
+    tree->hint_leaf = leaf;
+    tree->hint_pos = pos;
+    return leaf->base.keys[pos];
+}
+
+// the position of the first member >= (score, name)
+static bool find_pos(BTree *tree, double score, const char *name, size_t len,
+    BTLeaf **leaf, uint32_t *pos)
+{
+    if (!tree->root) {
+        return false;
+    }
+    *leaf = descend(tree, score, name, len, NULL);
+    *pos = node_search(&(*leaf)->base, score, name, len, false);
+    if (*pos == (*leaf)->base.n) {
+        // it is the first one of the next leaf
+        *leaf = (*leaf)->next;
+        *pos = 0;
+    }
+    return *leaf != NULL;
+}
+
+ZNode *bt_lower_bound(BTree *tree, double score, const char *name, size_t len) {
+    BTLeaf *leaf = NULL;
+    uint32_t pos = 0;
+    if (!find_pos(tree, score, name, len, &leaf, &pos)) {
+        return NULL;
+    }
+    return hint_set(tree, leaf, pos);
+}
+
+// the number of members before the node, O(log n)
+int64_t bt_rank(BTree *tree, ZNode *znode) {
+    BTNode *node = tree->root;
+    if (!node) {
+        return -1;
+    }
+    int64_t rank = 0;
+    while (!node->leaf) {
+        uint32_t i = child_for(node, znode->score, znode->name, znode->len);
+        for (uint32_t j = 0; j < i; ++j) {
+            rank += (int64_t)as_inner(node)->cnt[j];
+        }
+        node = as_inner(node)->kids[i];
+    }
+    uint32_t pos = node_search(node, znode->score, znode->name, znode->len, false);
+    if (pos == node->n || node->keys[pos] != znode) {
+        return -1;
+    }
+    return rank + pos;
+}
+
+// the member at a rank, O(log n)
+ZNode *bt_select(BTree *tree, size_t rank) {
+    BTNode *node = tree->root;
+    if (!node || rank >= bt_size(tree)) {
+        return NULL;
+    }
+    while (!node->leaf) {
+        uint32_t i = 0;
+        while (rank >= as_inner(node)->cnt[i]) {
+            rank -= as_inner(node)->cnt[i++];
+        }
+        node = as_inner(node)->kids[i];
+    }
+    return hint_set(tree, as_leaf(node), (uint32_t)rank);
+}
+
+// the member `offset` positions away. short walks follow the leaf links,
+// starting from the hint when iterating, longer ones go by rank.
+ZNode *bt_offset(BTree *tree, ZNode *znode, int64_t offset) {
+    BTLeaf *leaf = tree->hint_leaf;
+    uint32_t pos = tree->hint_pos;
+    if (!leaf || pos >= leaf->base.n || leaf->base.keys[pos] != znode) {
+        if (!find_pos(tree, znode->score, znode->name, znode->len, &leaf, &pos)) {
+            return NULL;
+        }
+        assert(leaf->base.keys[pos] == znode);
+    }
+    if (offset > (int64_t)k_bt_cap || offset < -(int64_t)k_bt_cap) {
+        int64_t rank = bt_rank(tree, znode) + offset;
+        return rank < 0 ? NULL : bt_select(tree, (size_t)rank);
+    }
+    int64_t i = (int64_t)pos + offset;
+    while (i >= (int64_t)leaf->base.n) {
+        i -= leaf->base.n;
+        leaf = leaf->next;
+        if (!leaf) {
+            return NULL;
+        }
+    }
+    while (i < 0) {
+        leaf = leaf->prev;
+        if (!leaf) {
+            return NULL;
+        }
+        i += leaf->base.n;
+    }
+    return hint_set(tree, leaf, (uint32_t)i);
+}
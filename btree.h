@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ZNode;
+struct BTNode;
+struct BTLeaf;
+
+// an order-statistic B+tree of zset members, an alternative to the AVL
+// index. a node holds up to k_bt_cap - 1 (score, member) pairs in arrays,
+// so a search compares a run of scores in one or two cache lines instead
+// of chasing a pointer per member. inner nodes keep the size of each
+// subtree for rank and select, and the leaves are linked for range scans.
+struct BTree {
+    BTNode *root = NULL;
+    // where the last member was found, so walking to the next one
+    // doesn't search from the root
+    BTLeaf *hint_leaf = NULL;
+    uint32_t hint_pos = 0;
+};
+
+void bt_insert(BTree *tree, ZNode *node);
+void bt_erase(BTree *tree, ZNode *node);
+void bt_build(BTree *tree, ZNode **nodes, size_t n);
+void bt_dispose(BTree *tree, void (*f)(ZNode *));
+size_t bt_size(BTree *tree);
+ZNode *bt_lower_bound(BTree *tree, double score, const char *name, size_t len);
+ZNode *bt_offset(BTree *tree, ZNode *node, int64_t offset);
+int64_t bt_rank(BTree *tree, ZNode *node);
+ZNode *bt_select(BTree *tree, size_t rank);
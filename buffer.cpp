@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "buffer.h"
+
+const size_t k_buf_init = 4096;
+// memory above this is returned once the buffer is drained
+const size_t k_buf_keep = 64 * 1024;
+
+// make room for at least `n` more bytes after the data
+void buf_reserve(Buffer *buf, size_t n) {
+  if (buf_room(buf) >= n) {
+    return;
+  }
+  size_t size = buf_size(buf);
+  // slide the data to the front if that frees enough space.
+  // only when the consumed part is at least as large as the data,
+  // so each byte is moved an amortized O(1) times.
+  if (size + n <= buf->cap && buf->begin >= size) {
+    memmove(buf->data, buf_data(buf), size);
+    buf->begin = 0;
+    buf->end = size;
+    return;
+  }
+  // grow geometrically
+  size_t cap = buf->cap ? buf->cap : k_buf_init;
+  while (cap < size + n) {
+    cap *= 2;
+  }
+  uint8_t *data = (uint8_t *)malloc(cap);
+  if (!data) {
+    die("out of memory");
+  }
+  if (size) {
+    memcpy(data, buf_data(buf), size);
+  }
+  free(buf->data);
+  buf->data = data;
+  buf->cap = cap;
+  buf->begin = 0;
+  buf->end = size;
+}
+
+void buf_append(Buffer *buf, const void *data, size_t n) {
+  buf_reserve(buf, n);
+  memcpy(buf->data + buf->end, data, n);
+  buf->end += n;
+}
+
+// `n` bytes were written directly into the free space
+void buf_commit(Buffer *buf, size_t n) {
+  assert(n <= buf_room(buf));
+  buf->end += n;
+}
+
+void buf_consume(Buffer *buf, size_t n) {
+  assert(n <= buf_size(buf));
+  buf->begin += n;
+  if (buf->begin == buf->end) {
+    // drained, start over from the front
+    buf->begin = buf->end = 0;
+    if (buf->cap > k_buf_keep) {
+      // shrink after a burst of large messages
+      buf_free(buf);
+    }
+  }
+}
+
+void buf_free(Buffer *buf) {
+  free(buf->data);
+  *buf = Buffer{};
+}
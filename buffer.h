@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// a growable byte buffer.
+// data is appended at the end and consumed from the front. consumed space
+// is reclaimed lazily, so removing a message from the front is O(1) instead
+// of a memmove of everything behind it.
+struct Buffer {
+  uint8_t *data = NULL;
+  size_t cap = 0;
+  size_t begin = 0; // start of the unconsumed data
+  size_t end = 0; // end of the data
+};
+
+inline uint8_t *buf_data(Buffer *buf) {
+  return buf->data + buf->begin;
+}
+
+inline size_t buf_size(Buffer *buf) {
+  return buf->end - buf->begin;
+}
+
+// free space after the data
+inline size_t buf_room(Buffer *buf) {
+  return buf->cap - buf->end;
+}
+
+void buf_reserve(Buffer *buf, size_t n);
+void buf_append(Buffer *buf, const void *data, size_t n);
+void buf_commit(Buffer *buf, size_t n);
+void buf_consume(Buffer *buf, size_t n);
+void buf_free(Buffer *buf);
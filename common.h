@@ -2,17 +2,89 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 
 #define container_of(ptr, type, member)  ({ \
   const typeof( ((type *)0)->member ) *__mptr = (ptr); \
   (type *)( (char *)__mptr - offsetof(type, member) );})
 
-static uint64_t str_hash(const uint8_t *data, size_t len) {
-  uint32_t h = 0x811C9DC5;
-  for (size_t i = 0; i < len; i++) {
-    h = (h + data[i] ) * 0x01000193;
+// wyhash: 8 bytes at a time, with 64x64->128-bit multiplies to mix
+static uint64_t wy_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static uint64_t wy_r8(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static uint64_t wy_r4(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static uint64_t hash_bytes(const uint8_t *data, size_t len, uint64_t seed) {
+  const uint64_t s0 = 0x2d358dccaa6c78a5ull, s1 = 0x8bb84b93962eacc9ull;
+  const uint64_t s2 = 0x4b33a62ed433d4a3ull, s3 = 0x4d5a2da51de1aa47ull;
+  const uint8_t *p = data;
+  seed ^= wy_mix(seed ^ s0, s1);
+  uint64_t a = 0, b = 0;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = (wy_r4(p) << 32) | wy_r4(p + mid);
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wy_mix(wy_r8(p) ^ s1, wy_r8(p + 8) ^ seed);
+        see1 = wy_mix(wy_r8(p + 16) ^ s2, wy_r8(p + 24) ^ see1);
+        see2 = wy_mix(wy_r8(p + 32) ^ s3, wy_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wy_mix(wy_r8(p) ^ s1, wy_r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
   }
-  return h;
+  __uint128_t r = (__uint128_t)(a ^ s1) * (b ^ seed);
+  return wy_mix((uint64_t)r ^ s0 ^ len, (uint64_t)(r >> 64) ^ s1);
+}
+
+static uint64_t hash_seed_init() {
+  uint64_t seed = 0;
+  if (getrandom(&seed, sizeof(seed), 0) != (ssize_t)sizeof(seed)) {
+    seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+  }
+  return seed;
+}
+
+// random per process, so that colliding keys can't be crafted.
+// it is not stable across restarts, never persist a str_hash().
+inline const uint64_t g_hash_seed = hash_seed_init();
+
+static uint64_t str_hash(const uint8_t *data, size_t len) {
+  return hash_bytes(data, len, g_hash_seed);
 }
 
 static void msg(const char *msg) {
@@ -34,10 +106,11 @@ enum {
   SER_ARR = 5,
 };
 
-static uint32_t max(uint32_t lhs, uint32_t rhs) {
+// 64-bit, so lengths and times in ms or ns are not truncated
+static uint64_t max(uint64_t lhs, uint64_t rhs) {
   return lhs < rhs ? rhs : lhs;
 }
 
-static uint32_t min(size_t lhs, size_t rhs) {
-  return lhs < rhs ? lhs : rhs; 
+static uint64_t min(uint64_t lhs, uint64_t rhs) {
+  return lhs < rhs ? lhs : rhs;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+// an HDR-style histogram of ns for the benchmarks: 128 buckets per
+// power of 2, so the percentiles are within 1%.
+const uint32_t k_hdr_sub_bits = 7;
+const uint32_t k_hdr_max_bits = 40;
+const uint32_t k_hdr_buckets = (k_hdr_max_bits - k_hdr_sub_bits + 1) << k_hdr_sub_bits;
+
+struct Hdr {
+  uint64_t count = 0;
+  uint64_t max = 0;
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(k_hdr_buckets);
+};
+
+inline uint32_t hdr_bucket(uint64_t v) {
+  if (v >> k_hdr_max_bits) {
+    v = ((uint64_t)1 << k_hdr_max_bits) - 1;
+  }
+  if (v < (1u << k_hdr_sub_bits)) {
+    return (uint32_t)v;
+  }
+  uint32_t e = 63 - (uint32_t)__builtin_clzll(v);
+  uint32_t sub = (uint32_t)(v >> (e - k_hdr_sub_bits)) & ((1u << k_hdr_sub_bits) - 1);
+  return ((e - k_hdr_sub_bits + 1) << k_hdr_sub_bits) | sub;
+}
+
+// the largest value of a bucket
+inline uint64_t hdr_bucket_max(uint32_t i) {
+  if (i < (1u << k_hdr_sub_bits)) {
+    return i;
+  }
+  uint32_t shift = (i >> k_hdr_sub_bits) - 1;
+  uint64_t sub = i & ((1u << k_hdr_sub_bits) - 1);
+  return ((((uint64_t)1 << k_hdr_sub_bits) + sub + 1) << shift) - 1;
+}
+
+inline void hdr_add(Hdr *h, uint64_t v) {
+  h->count++;
+  h->max = v > h->max ? v : h->max;
+  h->buckets[hdr_bucket(v)]++;
+}
+
+inline void hdr_merge(Hdr *h, const Hdr &other) {
+  h->count += other.count;
+  h->max = other.max > h->max ? other.max : h->max;
+  for (uint32_t i = 0; i < k_hdr_buckets; ++i) {
+    h->buckets[i] += other.buckets[i];
+  }
+}
+
+inline uint64_t hdr_quantile(const Hdr &h, double q) {
+  uint64_t rank = (uint64_t)ceil(q * (double)h.count);
+  rank = rank < 1 ? 1 : rank;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < k_hdr_buckets; ++i) {
+    seen += h.buckets[i];
+    if (seen >= rank) {
+      uint64_t v = hdr_bucket_max(i);
+      return v < h.max ? v : h.max;
+    }
+  }
+  return h.max;
+}
@@ -61,4 +61,26 @@ void heap_update(HeapItem *a, size_t pos, size_t len) {
     } else {
         heap_down(a, pos, len);
     }
-}
\ No newline at end of file
+}
+
+void heap_delete(std::vector<HeapItem> &a, size_t pos) {
+    // swap erased item with last ietms
+    a[pos] = a.back();
+    a.pop_back();
+    // update swapped item
+    if (pos < a.size()) {
+        heap_update(a.data(), pos, a.size());
+    }
+}
+
+void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t) {
+    if (pos < a.size()) {
+        // update
+        a[pos] = t;
+    } else {
+        // append
+        pos = a.size();
+        a.push_back(t);
+    }
+    heap_update(a.data(), pos, a.size());
+}
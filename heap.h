@@ -2,10 +2,13 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <vector>
 
 struct HeapItem { 
     uint64_t val; // heap value, expiration time.
     size_t *ref; // point to entry's heap idx. 
 };
 
-void heap_update(HeapItem * a, size_t pos, size_t len);
\ No newline at end of file
+void heap_update(HeapItem * a, size_t pos, size_t len);
+void heap_delete(std::vector<HeapItem> &a, size_t pos);
+void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t);
@@ -0,0 +1,526 @@
+// a load generator for the server: many connections, pipelining, key and
+// value size distributions, and a mix of GET/SET/ZADD/ZQUERY.
+//
+// closed loop (default): every connection keeps `--pipeline` requests in
+// flight, and sends the next one as soon as a response comes back.
+// open loop (`--rate`): requests are due at a fixed rate whatever the
+// server does, and the latency is measured from when a request was due,
+// not from when it was sent. a stalled server would otherwise hold back
+// the requests that would have seen the stall (coordinated omission).
+//
+// usage: loadgen [options], see usage()
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "hdr.h"
+
+enum {
+  OP_GET = 0,
+  OP_SET = 1,
+  OP_ZADD = 2,
+  OP_ZQUERY = 3,
+  OP_COUNT = 4,
+};
+
+static const char *const k_op_names[OP_COUNT] = {"get", "set", "zadd", "zquery"};
+
+struct Options {
+  const char *host = "127.0.0.1";
+  uint16_t port = 1235;
+  uint32_t threads = 1;
+  uint32_t conns = 50;
+  uint32_t pipeline = 1;
+  double seconds = 10;
+  double rate = 0; // requests per second in total, 0 for a closed loop
+  uint64_t keys = 100000;
+  double zipf = 0; // the exponent, 0 for uniform keys
+  uint32_t vmin = 100; // value sizes, uniform in [vmin, vmax]
+  uint32_t vmax = 100;
+  uint64_t zsets = 100; // zset keys
+  uint64_t members = 1000; // names per zset
+  uint32_t mix[OP_COUNT] = {80, 20, 0, 0}; // weights
+};
+
+static Options g_opt;
+
+static uint64_t now_ns() {
+  timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// xorshift64*, one per thread
+struct Rng {
+  uint64_t s = 0;
+};
+
+static uint64_t rng_next(Rng &r) {
+  r.s ^= r.s >> 12;
+  r.s ^= r.s << 25;
+  r.s ^= r.s >> 27;
+  return r.s * 0x2545f4914f6cdd1dull;
+}
+
+static double rng_unit(Rng &r) {
+  return (double)(rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// zipfian ranks in [0, n) by the method of Gray et al., "Quickly
+// generating billion-record synthetic databases". rank 0 is the hottest.
+struct Zipf {
+  uint64_t n = 0;
+  double theta = 0;
+  double alpha = 0;
+  double zetan = 0;
+  double eta = 0;
+};
+
+static double zeta(uint64_t n, double theta) {
+  double sum = 0;
+  for (uint64_t i = 1; i <= n; ++i) {
+    sum += 1.0 / pow((double)i, theta);
+  }
+  return sum;
+}
+
+static void zipf_init(Zipf &z, uint64_t n, double theta) {
+  z.n = n;
+  z.theta = theta;
+  z.alpha = 1.0 / (1.0 - theta);
+  z.zetan = zeta(n, theta);
+  z.eta = (1 - pow(2.0 / (double)n, 1 - theta)) / (1 - zeta(2, theta) / z.zetan);
+}
+
+static uint64_t zipf_next(const Zipf &z, Rng &r) {
+  double u = rng_unit(r);
+  double uz = u * z.zetan;
+  if (uz < 1) {
+    return 0;
+  }
+  if (uz < 1 + pow(0.5, z.theta)) {
+    return 1;
+  }
+  uint64_t rank = (uint64_t)((double)z.n * pow(z.eta * u - z.eta + 1, z.alpha));
+  return rank < z.n ? rank : z.n - 1;
+}
+
+static Zipf g_key_zipf;
+static Zipf g_zset_zipf;
+
+// a key index in [0, n). zipfian ranks are scrambled, so the hot keys
+// are spread over the shards of the server.
+static uint64_t pick_key(const Zipf &z, uint64_t n, Rng &r) {
+  if (g_opt.zipf <= 0) {
+    return rng_next(r) % n;
+  }
+  uint64_t rank = zipf_next(z, r);
+  return (rank * 0x9e3779b97f4a7c15ull) % n;
+}
+
+static int pick_op(Rng &r) {
+  uint32_t total = 0;
+  for (uint32_t w : g_opt.mix) {
+    total += w;
+  }
+  uint32_t x = (uint32_t)(rng_next(r) % total);
+  for (int op = 0; op < OP_COUNT; ++op) {
+    if (x < g_opt.mix[op]) {
+      return op;
+    }
+    x -= g_opt.mix[op];
+  }
+  return OP_GET;
+}
+
+// the request format of the server: the length, the number of args,
+// then every arg with its length.
+static void append_req(std::string &out, const std::vector<std::string> &cmd) {
+  uint32_t len = 4;
+  for (const std::string &s : cmd) {
+    len += 4 + (uint32_t)s.size();
+  }
+  uint32_t n = (uint32_t)cmd.size();
+  out.append((char *)&len, 4);
+  out.append((char *)&n, 4);
+  for (const std::string &s : cmd) {
+    uint32_t p = (uint32_t)s.size();
+    out.append((char *)&p, 4);
+    out.append(s);
+  }
+}
+
+struct Pending {
+  uint64_t start_ns = 0; // sent, or due in the open loop
+  int op = 0;
+};
+
+struct Conn {
+  int fd = -1;
+  std::string wbuf;
+  size_t wpos = 0;
+  std::string rbuf;
+  // in flight, oldest first
+  std::vector<Pending> pending;
+  size_t phead = 0;
+  // open loop: when the next request is due, and the interval
+  uint64_t next_due_ns = 0;
+  uint64_t interval_ns = 0;
+  bool want_write = false;
+};
+
+struct Worker {
+  uint32_t id = 0;
+  std::vector<Conn *> conns;
+  Rng rng;
+  std::string value; // random bytes to take values from
+  Hdr lat[OP_COUNT];
+  uint64_t errors = 0;
+  uint64_t done = 0;
+};
+
+static size_t inflight(Conn *c) {
+  return c->pending.size() - c->phead;
+}
+
+static void send_one(Worker &w, Conn *c, uint64_t start_ns) {
+  int op = pick_op(w.rng);
+  std::vector<std::string> cmd;
+  char key[32];
+  if (op == OP_GET || op == OP_SET) {
+    snprintf(key, sizeof(key), "key:%llu",
+      (unsigned long long)pick_key(g_key_zipf, g_opt.keys, w.rng));
+  } else {
+    snprintf(key, sizeof(key), "zset:%llu",
+      (unsigned long long)pick_key(g_zset_zipf, g_opt.zsets, w.rng));
+  }
+  switch (op) {
+  case OP_GET:
+    cmd = {"get", key};
+    break;
+  case OP_SET: {
+    uint32_t span = g_opt.vmax - g_opt.vmin + 1;
+    uint32_t vlen = g_opt.vmin + (uint32_t)(rng_next(w.rng) % span);
+    size_t off = (size_t)(rng_next(w.rng) % (w.value.size() - vlen + 1));
+    cmd = {"set", key, w.value.substr(off, vlen)};
+    break;
+  }
+  case OP_ZADD:
+    cmd = {"zadd", key, std::to_string(rng_next(w.rng) % 1000000),
+      "m:" + std::to_string(rng_next(w.rng) % g_opt.members)};
+    break;
+  default:
+    cmd = {"zquery", key, std::to_string(rng_next(w.rng) % 1000000), "", "0", "10"};
+    break;
+  }
+  append_req(c->wbuf, cmd);
+  c->pending.push_back(Pending{start_ns, op});
+}
+
+static bool flush(Conn *c) {
+  while (c->wpos < c->wbuf.size()) {
+    ssize_t rv = write(c->fd, c->wbuf.data() + c->wpos, c->wbuf.size() - c->wpos);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (rv <= 0) {
+      return false;
+    }
+    c->wpos += (size_t)rv;
+  }
+  if (c->wpos == c->wbuf.size()) {
+    c->wbuf.clear();
+    c->wpos = 0;
+  }
+  return true;
+}
+
+// read the responses, and record the latency of each one
+static bool on_readable(Worker &w, Conn *c) {
+  char buf[64 * 1024];
+  while (true) {
+    ssize_t rv = read(c->fd, buf, sizeof(buf));
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (rv <= 0) {
+      return false;
+    }
+    c->rbuf.append(buf, (size_t)rv);
+  }
+  uint64_t now = now_ns();
+  size_t pos = 0;
+  while (c->rbuf.size() - pos >= 4) {
+    uint32_t len = 0;
+    memcpy(&len, &c->rbuf[pos], 4);
+    if (c->rbuf.size() - pos < 4 + (size_t)len) {
+      break;
+    }
+    if (inflight(c) == 0) {
+      return false; // a response nobody asked for
+    }
+    Pending &p = c->pending[c->phead++];
+    if (len > 0 && (uint8_t)c->rbuf[pos + 4] == SER_ERR) {
+      w.errors++;
+    }
+    hdr_add(&w.lat[p.op], now - p.start_ns);
+    w.done++;
+    pos += 4 + len;
+  }
+  c->rbuf.erase(0, pos);
+  if (c->phead == c->pending.size()) {
+    c->pending.clear();
+    c->phead = 0;
+  }
+  return true;
+}
+
+static Conn *conn_open() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    die("socket()");
+  }
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(g_opt.port);
+  if (inet_pton(AF_INET, g_opt.host, &addr.sin_addr) != 1) {
+    die("bad host");
+  }
+  if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+    die("connect");
+  }
+  int val = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  Conn *c = new Conn();
+  c->fd = fd;
+  return c;
+}
+
+static void watch(int epfd, int op, Conn *c, bool want_write) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN | (want_write ? (uint32_t)EPOLLOUT : 0);
+  ev.data.ptr = c;
+  c->want_write = want_write;
+  if (epoll_ctl(epfd, op, c->fd, &ev)) {
+    die("epoll_ctl");
+  }
+}
+
+// send what is due on a connection: up to the pipeline depth in the
+// closed loop; in the open loop, every request whose time has come, as
+// long as the pipeline has room. the others wait, and their latency
+// keeps growing from when they were due.
+static void fill(Worker &w, Conn *c, uint64_t now) {
+  if (g_opt.rate <= 0) {
+    while (inflight(c) < g_opt.pipeline) {
+      send_one(w, c, now);
+    }
+    return;
+  }
+  while (c->next_due_ns <= now && inflight(c) < g_opt.pipeline) {
+    send_one(w, c, c->next_due_ns);
+    c->next_due_ns += c->interval_ns;
+  }
+}
+
+static void run_worker(Worker *wp, uint64_t start_ns, uint64_t end_ns) {
+  Worker &w = *wp;
+  int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    die("epoll_create1");
+  }
+  for (size_t i = 0; i < w.conns.size(); ++i) {
+    Conn *c = w.conns[i];
+    if (g_opt.rate > 0) {
+      c->interval_ns = (uint64_t)(1e9 * g_opt.conns / g_opt.rate);
+      // spread the connections over the interval
+      c->next_due_ns = start_ns + c->interval_ns * (w.id + i * g_opt.threads) / g_opt.conns;
+    }
+    watch(epfd, EPOLL_CTL_ADD, c, false);
+  }
+  std::vector<struct epoll_event> events(w.conns.size() + 1);
+  while (true) {
+    uint64_t now = now_ns();
+    if (now >= end_ns) {
+      break;
+    }
+    uint64_t wake = end_ns;
+    for (Conn *c : w.conns) {
+      fill(w, c, now);
+      if (!flush(c)) {
+        die("write()");
+      }
+      bool want_write = c->wpos < c->wbuf.size();
+      if (want_write != c->want_write) {
+        watch(epfd, EPOLL_CTL_MOD, c, want_write);
+      }
+      // a full pipeline waits for a response instead
+      if (g_opt.rate > 0 && inflight(c) < g_opt.pipeline && c->next_due_ns < wake) {
+        wake = c->next_due_ns;
+      }
+    }
+    int timeout_ms = wake <= now ? 0 : (int)((wake - now) / 1000000);
+    int rv = epoll_wait(epfd, events.data(), (int)events.size(), timeout_ms);
+    if (rv < 0 && errno != EINTR) {
+      die("epoll_wait");
+    }
+    for (int i = 0; i < rv; ++i) {
+      Conn *c = (Conn *)events[i].data.ptr;
+      if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        && !on_readable(w, c))
+      {
+        die("connection closed");
+      }
+    }
+  }
+  close(epfd);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--host IP] [--port N] [--threads N] [--conns N]"
+    " [--pipeline N] [--seconds S] [--rate OPS]"
+    " [--keys N] [--zipf THETA] [--value-size N | MIN:MAX]"
+    " [--zsets N] [--members N] [--mix GET,SET,ZADD,ZQUERY]\n", prog);
+  exit(1);
+}
+
+static void report(const char *name, const Hdr &h, double secs) {
+  printf("%-8s %10llu ops %11.0f ops/s  p50 %8.1f  p90 %8.1f  p99 %8.1f"
+    "  p99.9 %8.1f  p99.99 %8.1f  max %8.1f us\n",
+    name, (unsigned long long)h.count, (double)h.count / secs,
+    hdr_quantile(h, 0.5) / 1e3, hdr_quantile(h, 0.9) / 1e3,
+    hdr_quantile(h, 0.99) / 1e3, hdr_quantile(h, 0.999) / 1e3,
+    hdr_quantile(h, 0.9999) / 1e3, h.max / 1e3);
+}
+
+int main(int argc, char **argv) {
+  // `--conns` connections are split between `--threads` threads, each
+  // with `--pipeline` requests in flight at most.
+  // `--rate` switches to the open loop at that many requests per second.
+  // keys are `key:N` for N below `--keys`, uniform or zipfian with
+  // `--zipf`; zsets are `zset:N` below `--zsets`.
+  // `--mix` are the weights of the commands, 80,20,0,0 by default.
+  Options &o = g_opt;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      usage(argv[0]);
+    }
+    i++;
+    if (0 == strcmp(arg, "--host")) {
+      o.host = val;
+    } else if (0 == strcmp(arg, "--port")) {
+      o.port = (uint16_t)atoi(val);
+    } else if (0 == strcmp(arg, "--threads")) {
+      o.threads = (uint32_t)atoi(val);
+    } else if (0 == strcmp(arg, "--conns")) {
+      o.conns = (uint32_t)atoi(val);
+    } else if (0 == strcmp(arg, "--pipeline")) {
+      o.pipeline = (uint32_t)atoi(val);
+    } else if (0 == strcmp(arg, "--seconds")) {
+      o.seconds = atof(val);
+    } else if (0 == strcmp(arg, "--rate")) {
+      o.rate = atof(val);
+    } else if (0 == strcmp(arg, "--keys")) {
+      o.keys = (uint64_t)atoll(val);
+    } else if (0 == strcmp(arg, "--zipf")) {
+      o.zipf = atof(val);
+    } else if (0 == strcmp(arg, "--value-size")) {
+      if (2 != sscanf(val, "%u:%u", &o.vmin, &o.vmax)) {
+        o.vmin = o.vmax = (uint32_t)atoi(val);
+      }
+    } else if (0 == strcmp(arg, "--zsets")) {
+      o.zsets = (uint64_t)atoll(val);
+    } else if (0 == strcmp(arg, "--members")) {
+      o.members = (uint64_t)atoll(val);
+    } else if (0 == strcmp(arg, "--mix")) {
+      uint32_t *m = o.mix;
+      if (4 != sscanf(val, "%u,%u,%u,%u", &m[0], &m[1], &m[2], &m[3])) {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (o.threads < 1 || o.conns < o.threads || o.pipeline < 1 || o.keys < 1
+    || o.zsets < 1 || o.members < 1 || o.vmin > o.vmax || o.seconds <= 0
+    || o.mix[0] + o.mix[1] + o.mix[2] + o.mix[3] == 0
+    || (o.zipf > 0 && (o.zipf >= 1 || o.keys < 2 || o.zsets < 2)))
+  {
+    usage(argv[0]);
+  }
+  if (o.zipf > 0) {
+    zipf_init(g_key_zipf, o.keys, o.zipf);
+    zipf_init(g_zset_zipf, o.zsets, o.zipf);
+  }
+
+  std::vector<Worker> workers(o.threads);
+  for (uint32_t t = 0; t < o.threads; ++t) {
+    Worker &w = workers[t];
+    w.id = t;
+    w.rng.s = 0x9e3779b97f4a7c15ull * (t + 1);
+    for (uint32_t i = 0; i < o.vmax + 4096; ++i) {
+      w.value.push_back((char)('a' + rng_next(w.rng) % 26));
+    }
+  }
+  for (uint32_t i = 0; i < o.conns; ++i) {
+    workers[i % o.threads].conns.push_back(conn_open());
+  }
+
+  uint64_t start_ns = now_ns();
+  uint64_t end_ns = start_ns + (uint64_t)(o.seconds * 1e9);
+  std::vector<std::thread> threads;
+  for (Worker &w : workers) {
+    threads.emplace_back(run_worker, &w, start_ns, end_ns);
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double secs = (double)(now_ns() - start_ns) / 1e9;
+
+  printf("%u threads, %u conns, pipeline %u, %s", o.threads, o.conns,
+    o.pipeline, o.rate > 0 ? "open loop at " : "closed loop\n");
+  if (o.rate > 0) {
+    printf("%.0f ops/s\n", o.rate);
+  }
+  Hdr all;
+  uint64_t errors = 0;
+  for (int op = 0; op < OP_COUNT; ++op) {
+    Hdr h;
+    for (Worker &w : workers) {
+      hdr_merge(&h, w.lat[op]);
+    }
+    if (h.count) {
+      report(k_op_names[op], h, secs);
+    }
+    hdr_merge(&all, h);
+  }
+  for (Worker &w : workers) {
+    errors += w.errors;
+  }
+  report("all", all, secs);
+  printf("errors %llu\n", (unsigned long long)errors);
+  return 0;
+}
@@ -0,0 +1,385 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "rdb.h"
+#include "server_common.h"
+#include "server_data.h"
+#include "server_shard.h"
+#include "slab.h"
+#include "zset.h"
+
+// file layout, integers are little-endian:
+//   magic
+//   records:
+//     [type: u8][expire_at: i64, -1 for none][klen: u32][key]
+//     RDB_STR:  [vlen: u32][val]
+//     RDB_ZSET: [n: u32] then n * [score: f64][len: u32][name],
+//               in (score, name) order
+//   [RDB_EOF: u8][crc32 of everything before: u32]
+static const char k_rdb_magic[8] = {'B', 'Y', 'O', 'R', 'D', 'B', '0', '1'};
+
+enum {
+  RDB_STR = 1,
+  RDB_ZSET = 2,
+  RDB_EOF = 0xff,
+};
+
+const size_t k_rdb_chunk = 1 << 20;
+
+// CRC-32 (IEEE)
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+  static const std::vector<uint32_t> table = [] {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+struct RdbWriter {
+  int fd = -1;
+  std::string buf;
+  uint32_t crc = 0;
+  bool err = false;
+};
+
+static void w_flush(RdbWriter &w) {
+  w.crc = crc32_update(w.crc, (uint8_t *)w.buf.data(), w.buf.size());
+  const char *data = w.buf.data();
+  size_t len = w.buf.size();
+  while (len > 0 && !w.err) {
+    ssize_t rv = write(w.fd, data, len);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0) {
+      w.err = true;
+      break;
+    }
+    data += rv;
+    len -= (size_t)rv;
+  }
+  w.buf.clear();
+}
+
+static void w_put(RdbWriter &w, const void *data, size_t len) {
+  w.buf.append((const char *)data, len);
+  if (w.buf.size() >= k_rdb_chunk) {
+    w_flush(w);
+  }
+}
+
+static void w_u8(RdbWriter &w, uint8_t v) {
+  w_put(w, &v, 1);
+}
+
+static void w_u32(RdbWriter &w, uint32_t v) {
+  w_put(w, &v, 4);
+}
+
+static void w_str(RdbWriter &w, const char *data, size_t len) {
+  w_u32(w, (uint32_t)len);
+  w_put(w, data, len);
+}
+
+static void cb_save(Entry *ent, void *arg) {
+  RdbWriter &w = *(RdbWriter *)arg;
+  int64_t at_ms = entry_expire_at(ent);
+  w_u8(w, ent->type == T_STR ? RDB_STR : RDB_ZSET);
+  w_put(w, &at_ms, 8);
+  w_str(w, entry_key(ent), ent->klen);
+  if (ent->type == T_STR) {
+    uint32_t vlen = 0;
+    const char *val = entry_str(ent, &vlen);
+    w_str(w, val, vlen);
+    return;
+  }
+  // a sorted run, from the smallest (score, name)
+  ZSet *zset = entry_zset(ent);
+  w_u32(w, zset_size(zset));
+  ZNode *znode = zset_query(zset, -INFINITY, "", 0);
+  for (; znode; znode = znode_offset(zset, znode, +1)) {
+    w_put(w, &znode->score, 8);
+    w_str(w, znode->name, znode->len);
+  }
+}
+
+// write this shard to a temporary file and rename it over the snapshot.
+static bool rdb_write(const std::string &path) {
+  std::string tmp = path + ".tmp";
+  RdbWriter w;
+  w.fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w.fd < 0) {
+    msg("open snapshot");
+    return false;
+  }
+  w_put(w, k_rdb_magic, sizeof(k_rdb_magic));
+  db_foreach(&cb_save, &w);
+  w_u8(w, RDB_EOF);
+  w_flush(w);
+  uint32_t crc = w.crc;
+  w_u32(w, crc);
+  w_flush(w);
+  bool ok = !w.err && 0 == fsync(w.fd);
+  ok = 0 == close(w.fd) && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str())) {
+    msg("write snapshot");
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+static std::string rdb_path(uint32_t shard) {
+  return shard_path(g_config.rdb_path, shard);
+}
+
+// SAVE, blocks this shard until the snapshot is on disk.
+bool rdb_save() {
+  Rdb &rdb = g_data.rdb;
+  if (g_config.rdb_path.empty() || rdb.child > 0) {
+    return false;
+  }
+  if (!rdb_write(rdb_path(g_data.shard_id))) {
+    return false;
+  }
+  rdb.dirty = 0;
+  rdb.last_save_ms = get_monotonic_msec();
+  return true;
+}
+
+// BGSAVE, the forked child writes its copy-on-write image of the keyspace.
+bool rdb_bgsave() {
+  Rdb &rdb = g_data.rdb;
+  if (g_config.rdb_path.empty() || rdb.child > 0) {
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    msg("fork() error");
+    return false;
+  }
+  if (pid == 0) {
+    _exit(rdb_write(rdb_path(g_data.shard_id)) ? 0 : 1);
+  }
+  rdb.child = pid;
+  rdb.dirty_at_fork = rdb.dirty;
+  return true;
+}
+
+// called with the timers
+void rdb_cron() {
+  Rdb &rdb = g_data.rdb;
+  if (g_config.rdb_path.empty()) {
+    return;
+  }
+  uint64_t now_ms = get_monotonic_msec();
+  if (rdb.child > 0) {
+    int status = 0;
+    if (rdb.child != waitpid(rdb.child, &status, WNOHANG)) {
+      return;
+    }
+    rdb.child = -1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      rdb.dirty -= rdb.dirty_at_fork;
+      rdb.last_save_ms = now_ms;
+    } else {
+      msg("BGSAVE failed");
+    }
+  } else if (g_config.save_interval_ms && rdb.dirty
+    && now_ms >= rdb.last_save_ms + g_config.save_interval_ms)
+  {
+    (void)rdb_bgsave();
+  }
+}
+
+// when to wake up for the child or the next periodic snapshot.
+uint64_t rdb_next_ms() {
+  Rdb &rdb = g_data.rdb;
+  if (rdb.child > 0) {
+    return get_monotonic_msec() + 100;
+  }
+  if (g_config.save_interval_ms && rdb.dirty) {
+    return rdb.last_save_ms + g_config.save_interval_ms;
+  }
+  return (uint64_t)-1;
+}
+
+struct RdbReader {
+  const uint8_t *pos = NULL;
+  const uint8_t *end = NULL;
+  bool err = false;
+};
+
+static const uint8_t *r_get(RdbReader &r, size_t len) {
+  if (r.err || (size_t)(r.end - r.pos) < len) {
+    r.err = true;
+    return NULL;
+  }
+  const uint8_t *data = r.pos;
+  r.pos += len;
+  return data;
+}
+
+template <class T>
+static T r_num(RdbReader &r) {
+  T v = 0;
+  if (const uint8_t *data = r_get(r, sizeof(T))) {
+    memcpy(&v, data, sizeof(T));
+  }
+  return v;
+}
+
+static const char *r_str(RdbReader &r, uint32_t &len) {
+  len = r_num<uint32_t>(r);
+  return (const char *)r_get(r, len);
+}
+
+static void rdb_corrupt(const std::string &path) {
+  fprintf(stderr, "corrupt snapshot: %s\n", path.c_str());
+  exit(1);
+}
+
+// load the keys of this shard from a snapshot file.
+static void rdb_load(const std::string &path, size_t *applied, size_t *skipped) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    die("open snapshot");
+  }
+  struct stat st = {};
+  fstat(fd, &st);
+  size_t size = (size_t)st.st_size;
+  if (size < sizeof(k_rdb_magic) + 1 + 4) {
+    rdb_corrupt(path);
+  }
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    die("mmap snapshot");
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  const uint8_t *data = (const uint8_t *)map;
+  uint32_t crc = 0;
+  memcpy(&crc, data + size - 4, 4);
+  if (memcmp(data, k_rdb_magic, sizeof(k_rdb_magic))
+    || crc != crc32_update(0, data, size - 4))
+  {
+    rdb_corrupt(path);
+  }
+
+  RdbReader r;
+  r.pos = data + sizeof(k_rdb_magic);
+  r.end = data + size - 4;
+  int64_t now_ms = (int64_t)get_wall_msec();
+  uint32_t self = g_data.shard_id;
+  std::vector<ZNode *> nodes;
+  while (!r.err) {
+    uint8_t type = r_num<uint8_t>(r);
+    if (type == RDB_EOF) {
+      break;
+    }
+    int64_t at_ms = r_num<int64_t>(r);
+    uint32_t klen = 0;
+    const char *kdata = r_str(r, klen);
+    if (r.err || (type != RDB_STR && type != RDB_ZSET)) {
+      rdb_corrupt(path);
+    }
+    std::string key(kdata, klen);
+    bool owned = shard_of(key) == self;
+    *(owned ? applied : skipped) += 1;
+    bool keep = owned && (at_ms < 0 || at_ms > now_ms);
+
+    if (type == RDB_STR) {
+      uint32_t vlen = 0;
+      const char *vdata = r_str(r, vlen);
+      if (keep && !r.err) {
+        entry_load(kdata, klen, T_STR, vdata, vlen, at_ms);
+      }
+      continue;
+    }
+
+    uint32_t n = r_num<uint32_t>(r);
+    nodes.clear();
+    for (uint32_t i = 0; i < n && !r.err; ++i) {
+      double score = r_num<double>(r);
+      uint32_t len = 0;
+      const char *name = r_str(r, len);
+      if (keep && !r.err) {
+        nodes.push_back(znode_new(name, len, score));
+      }
+    }
+    if (!keep) {
+      continue;
+    }
+    Entry *ent = entry_load(kdata, klen, T_ZSET, NULL, 0, at_ms);
+    // the run is already sorted, build the tree in one pass
+    ZSet *zset = entry_zset(ent);
+    if (!zset_build(zset, nodes.data(), nodes.size())) {
+      for (ZNode *znode : nodes) {
+        zset_add(zset, znode->name, znode->len, znode->score);
+        znode_del(znode);
+      }
+    }
+  }
+  if (r.err) {
+    rdb_corrupt(path);
+  }
+  munmap(map, size);
+}
+
+// load the snapshot into this shard. like the AOF, every shard reads every
+// file and keeps the keys it owns. if keys moved to another shard because
+// the thread count changed, the snapshots are written again.
+void rdb_start() {
+  Rdb &rdb = g_data.rdb;
+  uint32_t self = g_data.shard_id;
+  uint32_t nshards = shard_count();
+  bool moved = false;
+  slab_bulk_begin();
+  for (uint32_t i = 0; ; ++i) {
+    std::string path = rdb_path(i);
+    if (access(path.c_str(), F_OK) != 0) {
+      if (i >= nshards) {
+        break;
+      }
+      continue;
+    }
+    size_t applied = 0, skipped = 0;
+    rdb_load(path, &applied, &skipped);
+    moved = moved || (i == self ? skipped > 0 : applied > 0);
+  }
+  slab_bulk_end();
+  rdb.last_save_ms = get_monotonic_msec();
+
+  shards_barrier();
+  if (moved && !rdb_save()) {
+    die("write snapshot");
+  }
+  shards_barrier();
+  if (self == 0) {
+    for (uint32_t i = nshards; ; ++i) {
+      if (unlink(rdb_path(i).c_str())) {
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// point-in-time binary snapshots of the keyspace, one file per shard.
+struct Rdb {
+  pid_t child = -1; // BGSAVE in progress
+  uint64_t dirty = 0; // writes since the last snapshot
+  uint64_t dirty_at_fork = 0;
+  uint64_t last_save_ms = 0;
+};
+
+void rdb_start();
+bool rdb_save();
+bool rdb_bgsave();
+void rdb_cron();
+uint64_t rdb_next_ms();
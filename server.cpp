@@ -1,370 +1,1235 @@
-#include <assert.h>
-#include <math.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <netinet/ip.h>
-#include <errno.h>
-#include <vector>
-#include <fcntl.h>
-#include <poll.h>
-#include <string>
-#include "common.h"
-#include "hashtable.h"
-#include "zset.h"
-#include "linked_list.h"
-#include "server_conn.h"
-#include "server_out.h"
-#include "server_data.h"
-#include "heap.h"
-#include "server_common.h"
-
-const uint64_t k_idle_timeout_ms = 5 * 1000;
-
-
-static bool try_flush_buffer(Conn *conn) {
-  ssize_t rv = 0;
-  do {
-    size_t remain = conn->wbuf_size - conn->wbuf_sent;
-    rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remain);
-  } while (rv < 0 && errno == EINTR);
-
-  if (rv < 0 && errno == EAGAIN) {
-    return false;
-  }
-  
-  if (rv < 0) {
-    msg("write() error");
-    conn->state = STATE_END;
-    return false;
-  }
-
-  conn->wbuf_sent += (size_t)rv;
-  assert(conn->wbuf_sent <= conn->wbuf_size);
-  if (conn->wbuf_sent == conn->wbuf_size) {
-    // response was fully sent
-    conn->state = STATE_REQ;
-    conn->wbuf_sent = 0;
-    conn->wbuf_size = 0;
-    return false;
-  }
-  // still go tsome data in wbuf
-  return true;
-}
-
-static void state_res(Conn *conn) {
-  while (try_flush_buffer(conn)) {}
-}
-
-const size_t k_max_args = 1024;
-
-static int32_t parse_req(
-  const uint8_t *data, size_t len, std::vector<std::string> &out) 
-{
-  if (len < 4) {
-    return -1;
-  }
-  uint32_t n = 0;
-  memcpy(&n, &data[0], 4);
-  if (n > k_max_args) {
-    return -1;
-  }
-
-  size_t pos = 4;
-  while (n--) {
-    if (pos + 4 > len) {
-      return -1;
-    }
-    uint32_t sz = 0;
-    memcpy(&sz, &data[pos], 4);
-    if (pos + 4 + sz > len) {
-      return -1;
-    }
-    out.push_back(std::string((char *)&data[pos + 4], sz));
-    pos += 4 + sz;
-  }
-
-  if (pos != len) {
-    return -1;  // trailing garbage
-  }
-  return 0;
-}
-
-enum {
-  RES_OK = 0,
-  RES_ERR = 1,
-  RES_NX = 2,
-};
-
-
-
-static bool cmd_is(const std::string &word, const char *cmd) {
-  return 0 == strcasecmp(word.c_str(), cmd);
-}
-
-static void do_request(std::vector<std::string> cmd, std::string &out) {
-  if (cmd.size() == 1 && cmd_is(cmd[0], "keys")) {
-    do_keys(cmd, out);
-  } else if (cmd.size() == 2 && cmd_is(cmd[0], "get")) {
-    do_get(cmd, out);
-  } else if (cmd.size() == 3 && cmd_is(cmd[0], "set")) {
-    do_set(cmd, out);
-  } else if (cmd.size() == 2 && cmd_is(cmd[0], "del")) {
-    do_del(cmd, out);
-  } else if (cmd.size() == 4 && cmd_is(cmd[0], "zadd")) {
-    do_zadd(cmd, out);
-  } else if (cmd.size() == 3 && cmd_is(cmd[0], "zrem")) {
-    do_zrem(cmd, out);
-  } else if (cmd.size() == 3 && cmd_is(cmd[0], "zscore")) {
-    do_zscore(cmd, out);
-  } else if (cmd.size() == 6 && cmd_is(cmd[0], "zquery")) {
-    do_zquery(cmd, out);
-  } else if (cmd.size() == 3 && cmd_is(cmd[0], "ttl")) {
-    do_expire(cmd, out);
-  } else {
-    // cmd is not recognized
-    out_err(out, ERR_UNKNOWN, "Unknown cmd");
-  }
-}
-
-static bool try_one_request(Conn *conn) {
-  // try to parse a request from the buffer
-  if (conn->rbuf_size < 4) {
-    // not enough data in the buffer. Will retry in the next iteration
-    return false;
-  }
-  uint32_t len = 0;
-  memcpy(&len, &conn->rbuf[0], 4);
-  if (len > k_max_msg) {
-    msg("too long");
-    conn->state = STATE_END;
-    return false;
-  }
-  if (4 + len > conn->rbuf_size) {
-    // not enough data in the buffer. Will retry in the next iteration
-    return false;
-  }
-
-  // parse the request
-  std::vector<std::string> cmd;
-  if (0 != parse_req(&conn->rbuf[4], len, cmd)) {
-    msg("bad req");
-    conn->state = STATE_END;
-    return false;
-  }
-
-  // got one request, generate the response.
-  std::string out;
-  do_request(cmd, out);
-
-  // pack the response into the buffer
-  if (4 + out.size() > k_max_msg) {
-    out.clear();
-    out_err(out, ERR_2BIG, "response is too big");
-  }
-  uint32_t wlen = (uint32_t)out.size();
-  memcpy(&conn->wbuf[0], &wlen, 4);
-  memcpy(&conn->wbuf[4], out.data(), out.size());
-  conn->wbuf_size = 4 + wlen;
-
-  // remove the request from the buffer.
-  // note: frequent memmove is inefficient.
-  // note: need better handling for production code.
-  size_t remain = conn->rbuf_size - 4 - len;
-  if (remain) {
-    memmove(conn->rbuf, &conn->rbuf[4 + len], remain);
-  }
-  conn->rbuf_size = remain;
-
-  // change state
-  conn->state = STATE_RES;
-  state_res(conn);
-
-  // continue the outer loop if the request was fully processed
-  return (conn->state == STATE_REQ);
-}
-
-
-static bool try_fill_buffer(Conn *conn) {
-  // try to fill the buffer
-  assert(conn->rbuf_size < sizeof(conn->rbuf));
-  ssize_t rv = 0;
-  do {
-    size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
-    rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
-  } while (rv <0 && errno == EINTR );
-  if (rv < 0 && errno == EAGAIN) {
-    return false;
-  }
-  if (rv < 0) {
-    msg("read() error");
-    conn->state = STATE_END;
-    return false;
-  }
-  if (rv == 0) {
-    if (conn->rbuf_size > 0) {
-      msg("unexpected EOF");
-    } else {
-      msg("EOF");
-    }
-    conn->state = STATE_END;
-    return false; 
-  }
-
-  conn->rbuf_size += (size_t)rv;
-  assert(conn->rbuf_size <= sizeof(conn -> rbuf));
-
-  // try to process requests one by one
-  while (try_one_request(conn)) {}
-  return (conn->state == STATE_REQ);
-}
-
-static void state_req(Conn *conn) {
-  while (try_fill_buffer(conn)) {}
-}
-
-static bool hnode_same(HNode *node, HNode *key) {
-  return node == key;
-}
-
-// takes the nearest timer from the list and use it to calculate the timeout value of poll.
-uint32_t next_timer_ms() {
-  uint64_t now_ms = get_monotonic_msec();
-  uint64_t next_ms = (uint64_t)-1;
-  // idle timer using linked list
-  if (!dlist_empty(&g_data.idle_list)) {
-    Conn *conn = container_of(g_data.idle_list.next, Conn, idle_list);
-    next_ms = conn->idle_start + k_idle_timeout_ms;
-  }
-  // ttl timers using heap
-  if (!g_data.heap.empty()) {
-    next_ms == g_data.heap[0].val;
-  }
-  // timeout
-  if (next_ms == (uint64_t)-1) {
-    return -1; // no timers
-  }
-  if (next_ms <= now_ms) {
-    return 0;
-  }
-
-  return (uint32_t)(next_ms - now_ms);
-}
-
-
-static void process_timers() {
-  uint64_t now_ms = get_monotonic_msec();
-  // idle timer with linked list.
-  while (!dlist_empty(&g_data.idle_list)) {
-    Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
-    uint64_t next_ms = next->idle_start + k_idle_timeout_ms;
-    if (next_ms >= now_ms) {
-      break; // not expired
-    }
-
-    printf("removing idle connection: %d\n", next->fd);
-    conn_done(next);
-  }
-  // ttl timer using a heap
-  // limit amount of work per loop iteration
-  const size_t k_max_works = 2000;
-  size_t nworks = 0;
-  const std::vector<HeapItem> &heap = g_data.heap;
-  while (!heap.empty() && heap[0].val < now_ms && nworks++ < k_max_works) {
-    // delete key-value
-    Entry *ent = container_of(heap[0].ref, Entry, heap_idx);
-    hm_pop(&g_data.db, &ent->node, &hnode_same);
-    entry_del(ent);
-  }
-}
-
-static void run_event_loop(int fd,  void (* req_func)(Conn *), void (* res_func)(Conn *)) {
-  std::vector<struct pollfd> poll_args;
-  while (true) {
-    poll_args.clear();
-    struct pollfd pfd = {fd, POLLIN, 0};
-    poll_args.push_back(pfd);
-    // connection fds
-    for (Conn *conn : g_data.fd2conn) {
-      if (!conn) {
-        continue;
-      }
-      struct pollfd pfd = {};
-      pfd.fd = conn->fd;
-      pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-      pfd.events = pfd.events | POLLERR;
-      poll_args.push_back(pfd);
-    }
-
-    // poll for active fds
-    int timeout_ms = (int)next_timer_ms();
-    int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeout_ms);
-    if (rv < 0) {
-      die("poll");
-    }
-
-    // process active connections
-    for (size_t i = 1; i < poll_args.size(); ++i) {
-      if (poll_args[i].revents) {
-        Conn *conn = g_data.fd2conn[poll_args[i].fd];
-        connection_io(conn, req_func, res_func);
-        if (conn->state == STATE_END) {
-          // client closed
-          // destroy connection
-          conn_done(conn);
-        }
-      }
-    }
-
-    // handle timers
-    process_timers();
-
-    // try to accept a new connection
-    if (poll_args[0].revents) {
-      (void)accept_new_conn(fd);
-    }
-  }
-}
-
-int main() {
-  // some initializaation
-  init_server_conn();
-  
-  int fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (fd < 0) {
-    die("socket()");
-  }
-
-  int val = 1;
-  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
-
-  // bind
-  struct sockaddr_in addr = {};
-  addr.sin_family = AF_INET;
-  addr.sin_port = ntohs(1235);
-  addr.sin_addr.s_addr = ntohl(0);
-
-  int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
-
-  if (rv) {
-    die("bind()");
-  }
-
-  // listen
-  rv = listen(fd, SOMAXCONN);
-  if (rv) {
-    die("listen()");
-  }
-
-  // set the listen fd to nonblocking mode
-  fd_set_nb(fd);
-
-  // event loop
-  run_event_loop(fd, state_req, state_res);
-
-  return 0;
-}
\ No newline at end of file
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <errno.h>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <linux/io_uring.h>
+#include <string>
+#include <thread>
+#include "common.h"
+#include "hashtable.h"
+#include "zset.h"
+#include "linked_list.h"
+#include "server_conn.h"
+#include "server_out.h"
+#include "server_data.h"
+#include "server_common.h"
+#include "server_shard.h"
+#include "server_evict.h"
+#include "uring.h"
+
+GConfig g_config;
+thread_local GData g_data;
+
+const uint64_t k_idle_timeout_ms = 5 * 1000;
+
+enum {
+  UR_ACCEPT = 1,
+  UR_RECV = 2,
+  UR_SEND = 3,
+  UR_MAILBOX = 4,
+};
+
+// a send in flight with the io_uring backend. it owns the data, so the
+// connection can queue more responses, or be closed, while the kernel
+// is still reading from it.
+struct UringSend {
+  int fd = -1;
+  uint64_t conn_id = 0;
+  Buffer buf;
+};
+
+static void uring_send(UringSend *op) {
+  io_uring_sqe *sqe = uring_sqe(g_data.uring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = op->fd;
+  sqe->addr = (uint64_t)buf_data(&op->buf);
+  sqe->len = (uint32_t)buf_size(&op->buf);
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uint64_t)op | UR_SEND;
+}
+
+// the io_uring counterpart of try_flush_buffer().
+// only one send is in flight per connection to keep the responses ordered.
+static void uring_flush(Conn *conn) {
+  if (conn->sending || buf_size(&conn->wbuf) == 0) {
+    return;
+  }
+  UringSend *op = new UringSend();
+  op->fd = conn->fd;
+  op->conn_id = conn->id;
+  std::swap(op->buf, conn->wbuf);
+  conn->sending = op;
+  uring_send(op);
+}
+
+// send as much of the pending responses as the socket takes.
+// returns true if some data is left and the socket may take more.
+static bool try_flush_buffer(Conn *conn) {
+  if (aof_hold_responses()) {
+    // sent once the AOF is fsynced, see aof_release()
+    if (!conn->aof_wait && buf_size(&conn->wbuf) > 0) {
+      conn->aof_wait = true;
+      g_data.aof.waiting_fds.push_back(conn->fd);
+    }
+    return false;
+  }
+  if (g_data.uring) {
+    // completes asynchronously, see uring_on_send()
+    uring_flush(conn);
+    return false;
+  }
+  if (buf_size(&conn->wbuf) == 0) {
+    return false;
+  }
+  ssize_t rv = 0;
+  do {
+    rv = write(conn->fd, buf_data(&conn->wbuf), buf_size(&conn->wbuf));
+  } while (rv < 0 && errno == EINTR);
+
+  if (rv < 0 && errno == EAGAIN) {
+    return false;
+  }
+  
+  if (rv < 0) {
+    msg("write() error");
+    conn->state = STATE_END;
+    return false;
+  }
+
+  buf_consume(&conn->wbuf, (size_t)rv);
+  g_data.stats.bytes_out += (uint64_t)rv;
+  // still go tsome data in wbuf
+  return buf_size(&conn->wbuf) > 0;
+}
+
+static void state_req(Conn *conn);
+
+static void state_res(Conn *conn) {
+  while (try_flush_buffer(conn)) {}
+  if (conn->state == STATE_RES && buf_size(&conn->wbuf) == 0) {
+    // responses were fully sent, continue with the held back requests
+    conn->state = STATE_REQ;
+    state_req(conn);
+  }
+}
+
+static int32_t parse_req_args(const uint8_t *data, size_t len, Cmd &out) {
+  if (len < 4) {
+    return -1;
+  }
+  uint32_t n = 0;
+  memcpy(&n, &data[0], 4);
+  if (n > k_max_args) {
+    return -1;
+  }
+
+  size_t pos = 4;
+  while (n--) {
+    if (pos + 4 > len) {
+      return -1;
+    }
+    uint32_t sz = 0;
+    memcpy(&sz, &data[pos], 4);
+    if (pos + 4 + sz > len) {
+      return -1;
+    }
+    out.args[out.n++] = std::string_view((char *)&data[pos + 4], sz);
+    pos += 4 + sz;
+  }
+
+  if (pos != len) {
+    return -1;  // trailing garbage
+  }
+  return 0;
+}
+
+// the args point into `data`, which must outlive the request.
+// on failure there are no args.
+static int32_t parse_req(const uint8_t *data, size_t len, Cmd &out) {
+  cmd_clear(out);
+  int32_t err = parse_req_args(data, len, out);
+  if (err) {
+    cmd_clear(out);
+  }
+  return err;
+}
+
+enum {
+  RES_OK = 0,
+  RES_ERR = 1,
+  RES_NX = 2,
+};
+
+
+
+// commands that modify the keyspace, logged to the AOF
+static bool cmd_is_write(const Cmd &cmd) {
+  return !cmd.empty() && (cmd_is(cmd[0], "set") || cmd_is(cmd[0], "del")
+    || cmd_is(cmd[0], "unlink") || cmd_is(cmd[0], "mset")
+    || cmd_is(cmd[0], "mdel")
+    || cmd_is(cmd[0], "zadd") || cmd_is(cmd[0], "zrem")
+    || cmd_is(cmd[0], "ttl") || cmd_is(cmd[0], "pexpireat"));
+}
+
+// writes that may add data, refused over maxmemory when nothing
+// can be evicted
+static bool cmd_is_denyoom(const Cmd &cmd) {
+  return !cmd.empty() && (cmd_is(cmd[0], "set") || cmd_is(cmd[0], "mset")
+    || cmd_is(cmd[0], "zadd"));
+}
+
+static void do_bgrewriteaof(Cmd &cmd, std::string &out) {
+  (void)cmd;
+  // an array, so the results of the shards can be merged
+  out_arr(out, 1);
+  out_int(out, aof_rewrite_start() ? 1 : 0);
+}
+
+// save and bgsave, every shard writes its own snapshot
+static void do_save(Cmd &cmd, std::string &out) {
+  bool ok = cmd_is(cmd[0], "save") ? rdb_save() : rdb_bgsave();
+  out_arr(out, 1);
+  out_int(out, ok ? 1 : 0);
+}
+
+static void do_request(Cmd &cmd, std::string &out) {
+  bool write = cmd_is_write(cmd);
+  size_t mark = write ? aof_log(cmd.args, cmd.n) : 0;
+
+  if (cmd.size() == 1 && cmd_is(cmd[0], "keys")) {
+    do_keys(cmd, out);
+  } else if (cmd.size() >= 2 && cmd_is(cmd[0], "scan")) {
+    do_scan(cmd, out);
+  } else if (cmd.size() == 2 && cmd_is(cmd[0], "get")) {
+    do_get(cmd, out);
+  } else if (cmd.size() == 3 && cmd_is(cmd[0], "set")) {
+    do_set(cmd, out);
+  } else if (cmd.size() >= 2 && cmd_is(cmd[0], "mget")) {
+    do_mget(cmd, out);
+  } else if (cmd.size() >= 3 && cmd.size() % 2 == 1 && cmd_is(cmd[0], "mset")) {
+    do_mset(cmd, out);
+  } else if (cmd.size() == 2 && cmd_is(cmd[0], "del")) {
+    do_del(cmd, out);
+  } else if (cmd.size() >= 2 && cmd_is(cmd[0], "mdel")) {
+    do_mdel(cmd, out);
+  } else if (cmd.size() == 2 && cmd_is(cmd[0], "unlink")) {
+    do_unlink(cmd, out);
+  } else if (cmd.size() >= 4 && cmd.size() % 2 == 0 && cmd_is(cmd[0], "zadd")) {
+    do_zadd(cmd, out);
+  } else if (cmd.size() >= 3 && cmd_is(cmd[0], "zrem")) {
+    do_zrem(cmd, out);
+  } else if (cmd.size() >= 3 && cmd_is(cmd[0], "zscore")) {
+    do_zscore(cmd, out);
+  } else if (cmd.size() == 6 && cmd_is(cmd[0], "zquery")) {
+    do_zquery(cmd, out);
+  } else if (cmd.size() >= 3 && cmd_is(cmd[0], "zscan")) {
+    do_zscan(cmd, out);
+  } else if (cmd.size() == 2 && cmd_is(cmd[0], "zcard")) {
+    do_zcard(cmd, out);
+  } else if (cmd.size() == 3
+    && (cmd_is(cmd[0], "zrank") || cmd_is(cmd[0], "zrevrank")))
+  {
+    do_zrank(cmd, out);
+  } else if ((cmd.size() == 4 || cmd.size() == 5) && cmd_is(cmd[0], "zrange")) {
+    do_zrange(cmd, out);
+  } else if (cmd.size() == 4 && cmd_is(cmd[0], "zcount")) {
+    do_zcount(cmd, out);
+  } else if (cmd.size() == 3 && cmd_is(cmd[0], "ttl")) {
+    do_expire(cmd, out);
+  } else if (cmd.size() == 3 && cmd_is(cmd[0], "pexpireat")) {
+    do_pexpireat(cmd, out);
+  } else if (!cmd.empty() && cmd.size() <= 2 && cmd_is(cmd[0], "info")) {
+    do_info(cmd, out);
+  } else if (cmd.size() >= 2 && cmd_is(cmd[0], "slowlog")) {
+    do_slowlog(cmd, out);
+  } else if (cmd.size() == 1 && cmd_is(cmd[0], "bgrewriteaof")) {
+    do_bgrewriteaof(cmd, out);
+  } else if (cmd.size() == 1
+    && (cmd_is(cmd[0], "save") || cmd_is(cmd[0], "bgsave")))
+  {
+    do_save(cmd, out);
+  } else {
+    // cmd is not recognized
+    out_err(out, ERR_UNKNOWN, "Unknown cmd");
+  }
+
+  if (write && out[0] == SER_ERR) {
+    aof_cancel(mark); // nothing was changed
+  } else if (write) {
+    g_data.rdb.dirty++;
+  }
+}
+
+// a request of a client. unlike a replay of the AOF, a write that adds
+// data is refused over maxmemory if nothing can be evicted.
+// the latency is recorded by command for INFO, and slow commands go to
+// the slow log with the fd of the client.
+static void do_client_request(Cmd &cmd, int fd, std::string &out) {
+  uint64_t t0 = get_monotonic_nsec();
+  uint32_t id = cmd.empty() ? (uint32_t)CMD_OTHER : cmd_id(cmd[0]);
+  // evicted keys are logged before the command
+  if (!cmd_is_denyoom(cmd) || evict_admit(out)) {
+    do_request(cmd, out);
+  }
+  uint64_t ns = get_monotonic_nsec() - t0;
+  hist_add(&g_data.stats.cmds[id], ns);
+  int64_t slower_than = g_config.slowlog_slower_than_us;
+  if (slower_than >= 0 && ns / 1000 >= (uint64_t)slower_than) {
+    slowlog_push(cmd, fd, ns / 1000);
+  }
+}
+
+// queue a response behind the ones not yet sent.
+static void conn_respond(Conn *conn, std::string &out) {
+  if (out.size() > g_config.max_msg) {
+    out.clear();
+    out_err(out, ERR_2BIG, "response is too big");
+  }
+  uint32_t wlen = (uint32_t)out.size();
+  buf_append(&conn->wbuf, &wlen, 4);
+  buf_append(&conn->wbuf, out.data(), out.size());
+}
+
+const uint32_t k_route_all = (uint32_t)-1;
+
+// the shard that executes a command, or `k_route_all` for commands
+// that span the whole keyspace.
+static uint32_t cmd_route(const Cmd &cmd) {
+  if (cmd.size() == 1 && (cmd_is(cmd[0], "keys")
+    || cmd_is(cmd[0], "bgrewriteaof") || cmd_is(cmd[0], "save")
+    || cmd_is(cmd[0], "bgsave")))
+  {
+    return k_route_all;
+  }
+  if ((!cmd.empty() && cmd.size() <= 2 && cmd_is(cmd[0], "info"))
+    || (cmd.size() >= 2 && cmd_is(cmd[0], "slowlog")))
+  {
+    return k_route_all;
+  }
+  if (cmd.size() >= 2 && cmd_is(cmd[0], "scan")) {
+    return scan_shard(cmd[1]); // the shard is in the cursor
+  }
+  if (cmd.size() >= 2) {
+    return shard_of(cmd[1]); // every other command is keyed by cmd[1]
+  }
+  return g_data.shard_id;
+}
+
+// hand the command to the shard that owns its key.
+// returns false if it can be executed by this thread, or if it was
+// and the response is in `out`.
+static bool try_forward(Conn *conn, Cmd &cmd, std::string &out) {
+  uint32_t nshards = shard_count();
+  if (nshards == 1) {
+    return false;
+  }
+  uint32_t self = g_data.shard_id;
+  uint32_t owner = cmd_route(cmd);
+  if (owner == self) {
+    return false;
+  }
+
+  if (owner == k_route_all) {
+    // run it here first, then pass the partial result around the ring.
+    // an error, like bad args, is answered right away.
+    do_client_request(cmd, conn->fd, out);
+    if (out[0] != SER_ARR) {
+      return false;
+    }
+  }
+  ShardMsg *msg = new ShardMsg();
+  msg->from = self;
+  msg->fd = conn->fd;
+  msg->conn_id = conn->id;
+  if (owner == k_route_all) {
+    msg->out.swap(out);
+    msg->fanout = nshards - 1;
+    owner = (self + 1) % nshards;
+  }
+  // the views die with the read buffer, the other shard gets a copy
+  msg->cmd.assign(cmd.args, cmd.args + cmd.n);
+  shard_send(owner, msg);
+  return true;
+}
+
+static bool try_one_request(Conn *conn) {
+  // try to parse a request from the buffer
+  if (buf_size(&conn->rbuf) < 4) {
+    // not enough data in the buffer. Will retry in the next iteration
+    return false;
+  }
+  uint32_t len = 0;
+  memcpy(&len, buf_data(&conn->rbuf), 4);
+  if (len > g_config.max_msg) {
+    msg("too long");
+    conn->state = STATE_END;
+    return false;
+  }
+  if (4 + len > buf_size(&conn->rbuf)) {
+    // not enough data in the buffer. Will retry in the next iteration
+    return false;
+  }
+
+  // parse the request, the args are views of the read buffer
+  Cmd &cmd = g_data.cmd;
+  if (0 != parse_req(buf_data(&conn->rbuf) + 4, len, cmd)) {
+    msg("bad req");
+    conn->state = STATE_END;
+    return false;
+  }
+
+  // keys of other shards are answered later through the mailbox
+  std::string out;
+  if (try_forward(conn, cmd, out)) {
+    cmd_clear(cmd);
+    buf_consume(&conn->rbuf, 4 + len);
+    conn->state = STATE_WAIT;
+    return false;
+  }
+
+  // got one request, generate the response.
+  if (out.empty()) {
+    do_client_request(cmd, conn->fd, out);
+  }
+  conn_respond(conn, out);
+  // remove the request from the buffer only now, consuming may free it
+  cmd_clear(cmd);
+  buf_consume(&conn->rbuf, 4 + len);
+  return true;
+}
+
+// stop parsing once this much output is waiting, so a client that
+// pipelines without reading can't grow the write buffer without bound.
+const size_t k_max_pending_out = 1 << 20;
+
+// execute every complete request in the read buffer
+static void handle_requests(Conn *conn) {
+  while (conn->state == STATE_REQ
+    && buf_size(&conn->wbuf) < k_max_pending_out
+    && try_one_request(conn)) {}
+}
+
+
+const size_t k_read_size = 16 * 1024;
+
+static bool try_fill_buffer(Conn *conn) {
+  if (g_data.uring) {
+    return false; // data is pushed in by the recv completions
+  }
+  // make room for the next read. if a large message is partially read,
+  // make room for all of it at once.
+  size_t want = k_read_size;
+  size_t size = buf_size(&conn->rbuf);
+  if (size >= 4) {
+    uint32_t len = 0;
+    memcpy(&len, buf_data(&conn->rbuf), 4);
+    if (len <= g_config.max_msg && 4 + len > size + want) {
+      want = 4 + len - size;
+    }
+  }
+  buf_reserve(&conn->rbuf, want);
+
+  // try to fill the buffer
+  ssize_t rv = 0;
+  do {
+    size_t cap = buf_room(&conn->rbuf);
+    rv = read(conn->fd, conn->rbuf.data + conn->rbuf.end, cap);
+  } while (rv <0 && errno == EINTR );
+  if (rv < 0 && errno == EAGAIN) {
+    return false;
+  }
+  if (rv < 0) {
+    msg("read() error");
+    conn->state = STATE_END;
+    return false;
+  }
+  if (rv == 0) {
+    if (buf_size(&conn->rbuf) > 0) {
+      msg("unexpected EOF");
+    } else {
+      msg("EOF");
+    }
+    conn->state = STATE_END;
+    return false; 
+  }
+
+  buf_commit(&conn->rbuf, (size_t)rv);
+  g_data.stats.bytes_in += (uint64_t)rv;
+  return true;
+}
+
+// read until EAGAIN and execute everything that was pipelined, then send
+// all the responses of the batch with a single write.
+static void state_req(Conn *conn) {
+  bool drained = false;
+  while (conn->state == STATE_REQ) {
+    handle_requests(conn);
+    while (!drained && conn->state == STATE_REQ
+      && buf_size(&conn->wbuf) < k_max_pending_out)
+    {
+      if (!try_fill_buffer(conn)) {
+        drained = true;
+        break;
+      }
+      handle_requests(conn);
+    }
+    if (buf_size(&conn->wbuf) == 0 || conn->state == STATE_END) {
+      return;
+    }
+    if (conn->state == STATE_WAIT) {
+      // send what is ready while the forwarded request is out
+      (void)try_flush_buffer(conn);
+      return;
+    }
+    // flush the batch.
+    // if it is fully sent, loop for the requests that were held back.
+    conn->state = STATE_RES;
+    while (try_flush_buffer(conn)) {}
+    if (conn->state == STATE_RES && buf_size(&conn->wbuf) == 0) {
+      conn->state = STATE_REQ;
+    }
+  }
+}
+
+static bool snode_same(SNode *node, SNode *key) {
+  return node == key;
+}
+
+// takes the nearest timer from the list and use it to calculate the timeout value of poll.
+uint32_t next_timer_ms() {
+  if (evict_pending()) {
+    return 0; // over maxmemory, the last pass ran out of time
+  }
+  uint64_t now_ms = get_monotonic_msec();
+  uint64_t next_ms = (uint64_t)-1;
+  // idle timer using linked list
+  if (!dlist_empty(&g_data.idle_list)) {
+    Conn *conn = container_of(g_data.idle_list.next, Conn, idle_list);
+    next_ms = conn->idle_start + k_idle_timeout_ms;
+  }
+  // ttl timers, AOF fsync and rewrite, snapshots.
+  for (uint64_t ms : {tw_next(&g_data.ttl_wheel), aof_next_ms(), rdb_next_ms()}) {
+    next_ms = min(next_ms, ms);
+  }
+  // timeout
+  if (next_ms == (uint64_t)-1) {
+    return -1; // no timers
+  }
+  if (next_ms <= now_ms) {
+    return 0;
+  }
+  // the timeout of poll() is an int
+  uint64_t wait_ms = next_ms - now_ms;
+  return wait_ms < INT32_MAX ? (uint32_t)wait_ms : INT32_MAX;
+}
+
+
+// active expiry runs for a time budget per loop iteration. a cycle that
+// ends with keys still due doubles the budget for the next one, and one
+// that catches up halves it. so a mass expiry is reclaimed with most of
+// the loop, and a few keys at a time cost a few microseconds, while
+// requests are still served between the cycles.
+const uint64_t k_expire_min_us = 1000;
+const uint64_t k_expire_max_us = 16000;
+const uint32_t k_expire_batch = 16; // keys between clock reads
+
+static void active_expire(uint64_t now_ms) {
+  uint64_t budget = g_data.expire_budget_us;
+  budget = budget < k_expire_min_us ? k_expire_min_us : budget;
+  uint64_t deadline = get_monotonic_usec() + budget;
+  bool behind = false;
+  for (uint32_t n = 1; ; ++n) {
+    TWTimer *timer = tw_pop(&g_data.ttl_wheel, now_ms);
+    if (!timer) {
+      break;
+    }
+    // delete key-value, big values are freed in the background
+    Entry *ent = entry_from_timer(timer);
+    sm_pop(&g_data.db, &ent->node, &snode_same);
+    entry_del_async(ent);
+    g_data.stats.expired_keys++;
+    if (n % k_expire_batch == 0 && get_monotonic_usec() >= deadline) {
+      behind = true;
+      break;
+    }
+  }
+  if (behind) {
+    budget = budget * 2 < k_expire_max_us ? budget * 2 : k_expire_max_us;
+  } else {
+    budget = budget / 2 > k_expire_min_us ? budget / 2 : k_expire_min_us;
+  }
+  g_data.expire_budget_us = budget;
+}
+
+static void process_timers() {
+  uint64_t now_ms = get_monotonic_msec();
+  // idle timer with linked list.
+  while (!dlist_empty(&g_data.idle_list)) {
+    Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
+    uint64_t next_ms = next->idle_start + k_idle_timeout_ms;
+    if (next_ms >= now_ms) {
+      break; // not expired
+    }
+
+    printf("removing idle connection: %d\n", next->fd);
+    conn_done(next);
+  }
+  active_expire(now_ms);
+  evict_cron();
+  // AOF fsync and rewrite, snapshots
+  aof_cron();
+  rdb_cron();
+}
+
+// write the AOF records of this iteration, then send the responses
+// that were held back for them. sending may run more requests.
+static void aof_commit() {
+  Aof &aof = g_data.aof;
+  while (!aof.buf.empty() || !aof.held_msgs.empty()
+    || !aof.waiting_fds.empty())
+  {
+    aof_flush();
+    for (ShardMsg *msg : aof.held_msgs) {
+      shard_send(msg->from, msg);
+    }
+    aof.held_msgs.clear();
+    std::vector<int> fds;
+    fds.swap(aof.waiting_fds);
+    for (int fd : fds) {
+      Conn *conn = g_data.fd2conn[fd];
+      if (!conn || !conn->aof_wait) {
+        continue; // closed
+      }
+      conn->aof_wait = false;
+      uint32_t state = conn->state;
+      if (state == STATE_RES) {
+        state_res(conn);
+      } else {
+        (void)try_flush_buffer(conn); // a forwarded request is out
+      }
+      if (conn->state == STATE_END) {
+        conn_done(conn);
+      } else if (conn->state != state) {
+        conn_update_events(conn);
+      }
+    }
+  }
+}
+
+// replay a record of the AOF. returns 0 if it is not applied here: the
+// key is owned by another shard, or the write fails now, which is only
+// a warning since the rest of the file is good. skipping a record of
+// our own file has the file rewritten without it, see aof_start().
+// returns -1 if the record is malformed.
+static int aof_exec(const uint8_t *data, size_t len) {
+  Cmd &cmd = g_data.cmd;
+  if (0 != parse_req(data, len, cmd) || !cmd_is_write(cmd)) {
+    return -1;
+  }
+  if (cmd_route(cmd) != g_data.shard_id) {
+    return 0;
+  }
+  std::string out;
+  do_request(cmd, out);
+  std::string err;
+  if (out_err_msg(out, err)) {
+    fprintf(stderr, "skipping failed AOF record: %s\n", err.c_str());
+    return 0;
+  }
+  return 1;
+}
+
+static void run_event_loop(int fd,  void (* req_func)(Conn *), void (* res_func)(Conn *)) {
+  std::vector<struct pollfd> poll_args;
+  while (true) {
+    poll_args.clear();
+    struct pollfd pfd = {fd, POLLIN, 0};
+    poll_args.push_back(pfd);
+    // connection fds
+    for (Conn *conn : g_data.fd2conn) {
+      if (!conn) {
+        continue;
+      }
+      struct pollfd pfd = {};
+      pfd.fd = conn->fd;
+      pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
+      pfd.events = pfd.events | POLLERR;
+      poll_args.push_back(pfd);
+    }
+
+    // poll for active fds
+    int timeout_ms = (int)next_timer_ms();
+    int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeout_ms);
+    if (rv < 0) {
+      die("poll");
+    }
+    uint64_t t0 = get_monotonic_nsec();
+
+    // process active connections
+    for (size_t i = 1; i < poll_args.size(); ++i) {
+      if (poll_args[i].revents) {
+        Conn *conn = g_data.fd2conn[poll_args[i].fd];
+        connection_io(conn, req_func, res_func);
+        if (conn->state == STATE_END) {
+          // client closed
+          // destroy connection
+          conn_done(conn);
+        }
+      }
+    }
+
+    // one write and fsync for the whole iteration
+    aof_commit();
+
+    // handle timers
+    process_timers();
+
+    // try to accept a new connection
+    if (poll_args[0].revents) {
+      (void)accept_new_conn(fd);
+    }
+    hist_add(&g_data.stats.loop, get_monotonic_nsec() - t0);
+  }
+}
+
+// execute a command forwarded by another shard.
+static void shard_exec(ShardMsg *msg) {
+  uint32_t self = g_data.shard_id;
+  if (msg->fanout) {
+    // an error is passed on as it is, there is nothing to merge into
+    if (msg->out[0] == SER_ARR) {
+      std::string out;
+      cmd_view(g_data.cmd, msg->cmd);
+      do_client_request(g_data.cmd, msg->fd, out);
+      if (out[0] == SER_ARR) {
+        arr_merge(msg->out, out);
+        // the last shard makes the reply out of the merged arrays
+        if (msg->fanout == 1 && cmd_is(g_data.cmd[0], "slowlog")) {
+          slowlog_merge(g_data.cmd, msg->out);
+        }
+      } else {
+        msg->out.swap(out);
+      }
+    }
+    if (--msg->fanout) {
+      return shard_send((self + 1) % shard_count(), msg);
+    }
+  } else {
+    cmd_view(g_data.cmd, msg->cmd);
+    do_client_request(g_data.cmd, msg->fd, msg->out);
+  }
+  msg->type = MSG_RES;
+  if (aof_hold_responses()) {
+    g_data.aof.held_msgs.push_back(msg); // see aof_release()
+    return;
+  }
+  shard_send(msg->from, msg);
+}
+
+// deliver the response of a forwarded command to its connection.
+static void shard_reply(ShardMsg *msg) {
+  Conn *conn = NULL;
+  if ((size_t)msg->fd < g_data.fd2conn.size()) {
+    conn = g_data.fd2conn[msg->fd];
+  }
+  // the connection may have been closed while waiting
+  if (conn && conn->id == msg->conn_id && conn->state == STATE_WAIT) {
+    conn_respond(conn, msg->out);
+    // send it, then continue with the requests queued behind it
+    conn->state = STATE_RES;
+    state_res(conn);
+    if (conn->state == STATE_END) {
+      conn_done(conn);
+    } else {
+      conn_update_events(conn);
+    }
+  }
+  delete msg;
+}
+
+static void process_mailbox() {
+  ShardMsg *msg = shard_recv(shard_get(g_data.shard_id));
+  while (msg) {
+    ShardMsg *next = msg->next;
+    if (msg->type == MSG_REQ) {
+      shard_exec(msg);
+    } else {
+      shard_reply(msg);
+    }
+    msg = next;
+  }
+}
+
+const size_t k_max_events = 1024;
+
+// edge-triggered epoll backend.
+// fds are registered once, and only switched between read and write interest
+// when the connection state changes, so each iteration costs O(active fds).
+static void run_epoll_loop(int fd,  void (* req_func)(Conn *), void (* res_func)(Conn *)) {
+  g_data.epfd = epoll_create1(0);
+  if (g_data.epfd < 0) {
+    die("epoll_create1");
+  }
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = fd;
+  if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, fd, &ev)) {
+    die("epoll_ctl");
+  }
+  // mailbox wakeups from other shards, level-triggered
+  int evfd = -1;
+  if (shard_count() > 1) {
+    evfd = shard_get(g_data.shard_id)->evfd;
+    ev.events = EPOLLIN;
+    ev.data.fd = evfd;
+    if (epoll_ctl(g_data.epfd, EPOLL_CTL_ADD, evfd, &ev)) {
+      die("epoll_ctl");
+    }
+  }
+
+  std::vector<struct epoll_event> events(k_max_events);
+  while (true) {
+    int timeout_ms = (int)next_timer_ms();
+    int rv = epoll_wait(g_data.epfd, events.data(), (int)events.size(), timeout_ms);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0) {
+      die("epoll_wait");
+    }
+    uint64_t t0 = get_monotonic_nsec();
+
+    bool accept_ready = false;
+    bool mailbox_ready = false;
+    for (int i = 0; i < rv; ++i) {
+      if (events[i].data.fd == fd) {
+        accept_ready = true;
+        continue;
+      }
+      if (events[i].data.fd == evfd) {
+        mailbox_ready = true;
+        continue;
+      }
+      Conn *conn = g_data.fd2conn[events[i].data.fd];
+      uint32_t state = conn->state;
+      connection_io(conn, req_func, res_func);
+      if (conn->state == STATE_END) {
+        // client closed
+        // destroy connection
+        conn_done(conn);
+      } else if (conn->state != state) {
+        conn_update_events(conn);
+      }
+    }
+
+    // commands and responses from other shards
+    if (mailbox_ready) {
+      process_mailbox();
+    }
+
+    // one write and fsync for the whole iteration
+    aof_commit();
+
+    // handle timers
+    process_timers();
+
+    // accept until the backlog is drained (edge-triggered)
+    if (accept_ready) {
+      while (accept_new_conn(fd) == 0) {}
+    }
+    hist_add(&g_data.stats.loop, get_monotonic_nsec() - t0);
+  }
+}
+
+// user_data of connection ops: the op, the fd and the low bits of the
+// connection id, so completions for a closed and reused fd are dropped.
+static uint64_t uring_conn_data(Conn *conn, uint64_t op) {
+  return ((uint64_t)(uint32_t)conn->id << 32) | ((uint64_t)conn->fd << 3) | op;
+}
+
+static Conn *uring_conn(uint64_t data) {
+  size_t fd = (uint32_t)data >> 3;
+  Conn *conn = fd < g_data.fd2conn.size() ? g_data.fd2conn[fd] : NULL;
+  if (conn && (uint32_t)conn->id == (uint32_t)(data >> 32)) {
+    return conn;
+  }
+  return NULL;
+}
+
+static void uring_accept(int fd) {
+  io_uring_sqe *sqe = uring_sqe(g_data.uring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = UR_ACCEPT;
+}
+
+// multishot recv into the provided buffers
+static void uring_recv(Conn *conn) {
+  io_uring_sqe *sqe = uring_sqe(g_data.uring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = g_data.uring->bgid;
+  sqe->user_data = uring_conn_data(conn, UR_RECV);
+}
+
+static void uring_poll_mailbox(int evfd) {
+  io_uring_sqe *sqe = uring_sqe(g_data.uring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = evfd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = UR_MAILBOX;
+}
+
+static void uring_on_recv(io_uring_cqe *cqe, void (* req_func)(Conn *), void (* res_func)(Conn *)) {
+  Uring *ring = g_data.uring;
+  Conn *conn = uring_conn(cqe->user_data);
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (conn && cqe->res > 0) {
+      buf_append(&conn->rbuf, uring_buf(ring, bid), (size_t)cqe->res);
+      g_data.stats.bytes_in += (uint64_t)cqe->res;
+    }
+    uring_buf_recycle(ring, bid);
+  }
+  if (!conn) {
+    return; // closed
+  }
+
+  if (cqe->res == 0) {
+    if (buf_size(&conn->rbuf) > 0) {
+      msg("unexpected EOF");
+    } else {
+      msg("EOF");
+    }
+    conn->state = STATE_END;
+  } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+    msg("recv() error");
+    conn->state = STATE_END;
+  } else {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      uring_recv(conn); // the multishot recv ended, e.g. out of buffers
+    }
+    if (cqe->res > 0) {
+      connection_io(conn, req_func, res_func);
+    }
+  }
+  if (conn->state == STATE_END) {
+    conn_done(conn);
+  }
+}
+
+static void uring_on_send(io_uring_cqe *cqe, void (* req_func)(Conn *), void (* res_func)(Conn *)) {
+  UringSend *op = (UringSend *)(cqe->user_data & ~(uint64_t)7);
+  Conn *conn = NULL;
+  if ((size_t)op->fd < g_data.fd2conn.size()) {
+    conn = g_data.fd2conn[op->fd];
+  }
+  if (!conn || conn->id != op->conn_id || conn->sending != op) {
+    // the connection was closed while sending
+    buf_free(&op->buf);
+    delete op;
+    return;
+  }
+  if (cqe->res < 0) {
+    msg("send() error");
+    conn->state = STATE_END;
+  } else {
+    buf_consume(&op->buf, (size_t)cqe->res);
+    g_data.stats.bytes_out += (uint64_t)cqe->res;
+    if (buf_size(&op->buf) > 0) {
+      return uring_send(op); // partial send, continue with the rest
+    }
+    if (conn->wbuf.cap == 0) {
+      std::swap(conn->wbuf, op->buf); // reuse the allocation
+    }
+  }
+  buf_free(&op->buf);
+  delete op;
+  conn->sending = NULL;
+
+  // send the next batch, or go back to the requests held back
+  if (conn->state != STATE_END) {
+    connection_io(conn, req_func, res_func);
+  }
+  if (conn->state == STATE_END) {
+    conn_done(conn);
+  }
+}
+
+const unsigned k_uring_entries = 4096;
+const uint16_t k_uring_nbufs = 256;
+const uint32_t k_uring_buf_size = 16 * 1024;
+
+// completion-based io_uring backend: multishot accept, multishot recv into
+// provided buffers, and every SQE of an iteration submitted by one syscall.
+static void run_uring_loop(int fd,  void (* req_func)(Conn *), void (* res_func)(Conn *)) {
+  Uring *ring = new Uring();
+  if (uring_init(ring, k_uring_entries)
+    || uring_bufs_init(ring, 0, k_uring_nbufs, k_uring_buf_size))
+  {
+    die("io_uring is not supported");
+  }
+  g_data.uring = ring;
+  uring_accept(fd);
+  if (shard_count() > 1) {
+    uring_poll_mailbox(shard_get(g_data.shard_id)->evfd);
+  }
+
+  while (true) {
+    int timeout_ms = (int)next_timer_ms();
+    if (uring_enter(ring, timeout_ms) < 0) {
+      die("io_uring_enter");
+    }
+    uint64_t t0 = get_monotonic_nsec();
+
+    bool mailbox_ready = false;
+    while (io_uring_cqe *ptr = uring_cqe(ring)) {
+      io_uring_cqe cqe = *ptr;
+      uring_cqe_done(ring);
+      switch (cqe.user_data & 7) {
+      case UR_ACCEPT:
+        if (cqe.res >= 0) {
+          if (Conn *conn = conn_new(cqe.res)) {
+            uring_recv(conn);
+          }
+        } else if (cqe.res != -EAGAIN) {
+          msg("accept() error");
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          uring_accept(fd);
+        }
+        break;
+      case UR_RECV:
+        uring_on_recv(&cqe, req_func, res_func);
+        break;
+      case UR_SEND:
+        uring_on_send(&cqe, req_func, res_func);
+        break;
+      case UR_MAILBOX:
+        mailbox_ready = true;
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+          uring_poll_mailbox(shard_get(g_data.shard_id)->evfd);
+        }
+        break;
+      }
+    }
+
+    // commands and responses from other shards
+    if (mailbox_ready) {
+      process_mailbox();
+    }
+
+    // one write and fsync for the whole iteration
+    aof_commit();
+
+    // handle timers
+    process_timers();
+    hist_add(&g_data.stats.loop, get_monotonic_nsec() - t0);
+  }
+}
+
+static int create_listener(bool reuseport) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    die("socket()");
+  }
+
+  int val = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+  if (reuseport) {
+    // one listener per reactor, the kernel spreads the connections
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+  }
+
+  // bind
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = ntohs(1235);
+  addr.sin_addr.s_addr = ntohl(0);
+
+  int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
+
+  if (rv) {
+    die("bind()");
+  }
+
+  // listen
+  rv = listen(fd, SOMAXCONN);
+  if (rv) {
+    die("listen()");
+  }
+
+  // set the listen fd to nonblocking mode
+  fd_set_nb(fd);
+  return fd;
+}
+
+// a reactor thread serving one shard of the keyspace.
+static void run_shard(uint32_t id) {
+  g_data.shard_id = id;
+  g_data.stats.start_ms = get_monotonic_msec();
+  tw_init(&g_data.ttl_wheel, get_monotonic_msec());
+  // the AOF has the latest writes, the snapshot is only used without it
+  if (!g_config.aof_path.empty()) {
+    aof_start(&aof_exec);
+  } else if (!g_config.rdb_path.empty()) {
+    rdb_start();
+  }
+  init_server_conn();
+  int fd = create_listener(true);
+  if (g_config.io == IO_URING) {
+    run_uring_loop(fd, state_req, state_res);
+  } else {
+    run_epoll_loop(fd, state_req, state_res);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--poll | --uring] [--threads N] [--max-msg BYTES]"
+    " [--aof PATH [--appendfsync always|everysec|no]]"
+    " [--dbfile PATH [--save SECONDS]] [--lazyfree-del]"
+    " [--zset-max-packed N] [--zset-max-packed-len BYTES]"
+    " [--zset-index avl|btree] [--maxmemory BYTES"
+    " [--maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|volatile-ttl]]"
+    " [--slowlog-slower-than US] [--slowlog-max-len N]\n",
+    prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  // a client may close with responses in flight, report it as EPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  // `--poll` selects the fallback poll() loop instead of epoll,
+  // `--uring` the io_uring backend
+  // `--threads N` runs N shared-nothing reactors, each owning a shard
+  // `--aof PATH` logs every write, `--appendfsync` picks when it is fsynced
+  // `--dbfile PATH` is the snapshot for SAVE/BGSAVE, `--save` takes one
+  // periodically
+  // `--lazyfree-del` makes DEL free large values in the background
+  // `--zset-max-packed` and `--zset-max-packed-len` are the limits of the
+  // packed zset encoding, 0 disables it
+  // `--zset-index` picks the ordered index of large zsets
+  // `--maxmemory` limits the keyspace, `--maxmemory-policy` picks what is
+  // evicted over the limit
+  // `--slowlog-slower-than` is the latency in us from which commands are
+  // kept in the slow log, -1 disables it. `--slowlog-max-len` bounds it.
+  uint32_t nthreads = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "--poll")) {
+      g_config.io = IO_POLL;
+    } else if (0 == strcmp(argv[i], "--uring")) {
+      g_config.io = IO_URING;
+    } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+      nthreads = (uint32_t)atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--max-msg") && i + 1 < argc) {
+      g_config.max_msg = (size_t)atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--aof") && i + 1 < argc) {
+      g_config.aof_path = argv[++i];
+    } else if (0 == strcmp(argv[i], "--lazyfree-del")) {
+      g_config.lazyfree_del = true;
+    } else if (0 == strcmp(argv[i], "--dbfile") && i + 1 < argc) {
+      g_config.rdb_path = argv[++i];
+    } else if (0 == strcmp(argv[i], "--save") && i + 1 < argc) {
+      g_config.save_interval_ms = (uint64_t)atoll(argv[++i]) * 1000;
+    } else if (0 == strcmp(argv[i], "--zset-max-packed") && i + 1 < argc) {
+      g_zset_pack_max_n = (size_t)atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--zset-max-packed-len") && i + 1 < argc) {
+      g_zset_pack_max_len = (size_t)atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--zset-index") && i + 1 < argc) {
+      const char *index = argv[++i];
+      if (0 == strcmp(index, "avl")) {
+        g_zset_index = ZINDEX_AVL;
+      } else if (0 == strcmp(index, "btree")) {
+        g_zset_index = ZINDEX_BTREE;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (0 == strcmp(argv[i], "--maxmemory") && i + 1 < argc) {
+      g_config.maxmemory = (uint64_t)atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--maxmemory-policy") && i + 1 < argc) {
+      const char *policy = argv[++i];
+      if (0 == strcmp(policy, "noeviction")) {
+        g_config.evict_policy = EVICT_NONE;
+      } else if (0 == strcmp(policy, "allkeys-lru")) {
+        g_config.evict_policy = EVICT_ALLKEYS_LRU;
+      } else if (0 == strcmp(policy, "allkeys-lfu")) {
+        g_config.evict_policy = EVICT_ALLKEYS_LFU;
+      } else if (0 == strcmp(policy, "volatile-ttl")) {
+        g_config.evict_policy = EVICT_VOLATILE_TTL;
+      } else {
+        usage(argv[0]);
+      }
+    } else if (0 == strcmp(argv[i], "--slowlog-slower-than") && i + 1 < argc) {
+      g_config.slowlog_slower_than_us = atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--slowlog-max-len") && i + 1 < argc) {
+      g_config.slowlog_max_len = (size_t)atoll(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--appendfsync") && i + 1 < argc) {
+      const char *mode = argv[++i];
+      if (0 == strcmp(mode, "always")) {
+        g_config.aof_fsync = AOF_FSYNC_ALWAYS;
+      } else if (0 == strcmp(mode, "everysec")) {
+        g_config.aof_fsync = AOF_FSYNC_EVERYSEC;
+      } else if (0 == strcmp(mode, "no")) {
+        g_config.aof_fsync = AOF_FSYNC_NO;
+      } else {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (nthreads < 1 || (nthreads > 1 && g_config.io == IO_POLL)
+      || g_config.max_msg < 4096
+      || g_config.max_msg > INT32_MAX) {
+    usage(argv[0]);
+  }
+
+  if (nthreads > 1) {
+    shards_init(nthreads);
+    for (uint32_t i = 1; i < nthreads; ++i) {
+      std::thread(run_shard, i).detach();
+    }
+    run_shard(0);
+    return 0;
+  }
+
+  // some initializaation
+  g_data.stats.start_ms = get_monotonic_msec();
+  tw_init(&g_data.ttl_wheel, get_monotonic_msec());
+  // the AOF has the latest writes, the snapshot is only used without it
+  if (!g_config.aof_path.empty()) {
+    aof_start(&aof_exec);
+  } else if (!g_config.rdb_path.empty()) {
+    rdb_start();
+  }
+  init_server_conn();
+  int fd = create_listener(false);
+
+  // event loop
+  if (g_config.io == IO_URING) {
+    run_uring_loop(fd, state_req, state_res);
+  } else if (g_config.io == IO_EPOLL) {
+    run_epoll_loop(fd, state_req, state_res);
+  } else {
+    run_event_loop(fd, state_req, state_res);
+  }
+
+  return 0;
+}
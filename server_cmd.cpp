@@ -0,0 +1,60 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "server_cmd.h"
+
+// drop the views of the last request, so none of them outlives it
+void cmd_clear(Cmd &cmd) {
+  for (size_t i = 0; i < cmd.n; ++i) {
+    cmd.args[i] = std::string_view();
+  }
+  cmd.n = 0;
+}
+
+// views of owned args, for a command forwarded by another shard
+void cmd_view(Cmd &cmd, const std::vector<std::string> &args) {
+  cmd_clear(cmd);
+  cmd.n = args.size() < k_max_args ? args.size() : k_max_args;
+  for (size_t i = 0; i < cmd.n; ++i) {
+    cmd.args[i] = args[i];
+  }
+}
+
+bool cmd_is(std::string_view word, const char *name) {
+  return word.size() == strlen(name)
+    && 0 == strncasecmp(word.data(), name, word.size());
+}
+
+// the args are not NUL-terminated, a number is copied out to parse it.
+// no valid number is this long.
+const size_t k_max_num_len = 128;
+
+static bool num_copy(std::string_view s, char *buf) {
+  if (s.size() >= k_max_num_len) {
+    return false;
+  }
+  memcpy(buf, s.data(), s.size());
+  buf[s.size()] = '\0';
+  return true;
+}
+
+bool str2int(std::string_view s, int64_t &out) {
+  char buf[k_max_num_len];
+  if (!num_copy(s, buf)) {
+    return false;
+  }
+  char *endp = NULL;
+  out = strtoll(buf, &endp, 10);
+  return endp == buf + s.size();
+}
+
+bool str2dbl(std::string_view s, double &out) {
+  char buf[k_max_num_len];
+  if (!num_copy(s, buf)) {
+    return false;
+  }
+  char *endp = NULL;
+  out = strtod(buf, &endp);
+  return endp == buf + s.size() && !isnan(out);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// the most args of a request
+const size_t k_max_args = 1024;
+
+// the args of a request, as views of the request in the read buffer of
+// the connection. nothing is copied by the parser, a handler copies what
+// it keeps, and the views are valid until the request is consumed.
+// a shard reuses one for every request, see GData::cmd.
+struct Cmd {
+  std::string_view args[k_max_args];
+  size_t n = 0;
+
+  size_t size() const { return n; }
+  bool empty() const { return n == 0; }
+  std::string_view operator[](size_t i) const { return args[i]; }
+};
+
+void cmd_clear(Cmd &cmd);
+void cmd_view(Cmd &cmd, const std::vector<std::string> &args);
+bool cmd_is(std::string_view word, const char *name);
+bool str2int(std::string_view s, int64_t &out);
+bool str2dbl(std::string_view s, double &out);
@@ -1,24 +1,113 @@
-#pragma once;
+#pragma once
 
-#include "hashtable.h"
+#include <time.h>
+#include <string>
 #include <vector>
+#include "aof.h"
+#include "rdb.h"
+#include "hashtable.h"
+#include "swisstable.h"
 #include "linked_list.h"
-#include "heap.h"
+#include "timewheel.h"
+#include "server_cmd.h"
 #include "server_conn.h"
+#include "server_stats.h"
+#include "server_slowlog.h"
+
+enum {
+  IO_EPOLL = 0,
+  IO_POLL = 1,
+  IO_URING = 2,
+};
+
+// what is evicted over maxmemory
+enum {
+  EVICT_NONE = 0, // noeviction: writes that add data fail instead
+  EVICT_ALLKEYS_LRU = 1, // the least recently used key
+  EVICT_ALLKEYS_LFU = 2, // the least frequently used key
+  EVICT_VOLATILE_TTL = 3, // the key with a ttl that expires the soonest
+};
+
+// process-wide settings, read-only once the reactors are running.
+struct GConfig {
+    // the event loop backend
+    uint32_t io = IO_EPOLL;
+    // the largest request or response, excluding the 4-byte header.
+    size_t max_msg = 32 << 20;
+    // append-only file, empty if persistence is off
+    std::string aof_path;
+    uint32_t aof_fsync = AOF_FSYNC_EVERYSEC;
+    // binary snapshots, and how often to take one if anything changed
+    std::string rdb_path;
+    uint64_t save_interval_ms = 0;
+    // DEL frees large values in the background like UNLINK
+    bool lazyfree_del = false;
+    // a memory limit for the keyspace, split evenly between the shards.
+    // 0 is no limit.
+    uint64_t maxmemory = 0;
+    uint32_t evict_policy = EVICT_NONE;
+    // commands slower than this go to the slow log, -1 disables it
+    int64_t slowlog_slower_than_us = 10000;
+    size_t slowlog_max_len = 128;
+};
 
-static struct {
+extern GConfig g_config;
+
+struct Uring;
+
+struct GData {
     // data structure for the key space
-    HMap db;
+    SwissMap db;
     // a map of all client connections, keyed by fd
     std::vector<Conn *> fd2conn;
     // timeers for idle connections
     DList idle_list;
     // timers for ttls.
-    std::vector<HeapItem> heap;
-} g_data;
+    TWheel ttl_wheel;
+    // time for active expiry per loop iteration, see active_expire()
+    uint64_t expire_budget_us = 0;
+    // counters for INFO
+    Stats stats;
+    SlowLog slowlog;
+    // epoll instance, -1 when running the poll() fallback.
+    int epfd = -1;
+    // io_uring instance when running the completion-based backend.
+    Uring *uring = NULL;
+    // the shard served by this reactor thread.
+    uint32_t shard_id = 0;
+    uint64_t next_conn_id = 0;
+    // the args of the request being executed
+    Cmd cmd;
+    // persistence of this shard
+    Aof aof;
+    Rdb rdb;
+};
+
+// defined in server.cpp. each reactor thread owns a private copy,
+// keys are routed to the owning thread (see server_shard.h).
+extern thread_local GData g_data;
 
 static uint64_t get_monotonic_msec() {
     timespec tv = {0, 0};
     clock_gettime(CLOCK_MONOTONIC, &tv);
     return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
-}
\ No newline at end of file
+}
+
+static uint64_t get_monotonic_nsec() {
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t get_monotonic_usec() {
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+// unix time, for what is persisted across restarts
+static uint64_t get_wall_msec() {
+    timespec tv = {0, 0};
+    clock_gettime(CLOCK_REALTIME, &tv);
+    return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
+}
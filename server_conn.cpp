@@ -10,11 +10,14 @@
 #include <assert.h>
 #include <time.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "common.h"
 #include "server_conn.h"
 #include "linked_list.h"
 #include "server_common.h"
+#include "uring.h"
+#include "slab.h"
 
 void fd_set_nb(int fd) {
   errno = 0;
@@ -40,33 +43,76 @@ static void conn_put(std::vector<Conn *> &fd2conn, struct Conn *conn) {
   fd2conn[conn->fd] = conn;
 }
 
+// epoll interest for the current state of the connection.
+// edge-triggered, so the handlers must drain the socket until EAGAIN.
+static uint32_t conn_events(Conn *conn) {
+  uint32_t events = 0;
+  if (conn->state == STATE_REQ) {
+    events = EPOLLIN;
+  } else if (conn->state == STATE_RES) {
+    events = EPOLLOUT;
+  }
+  return events | EPOLLET;
+}
+
+static void conn_watch(Conn *conn, int op) {
+  if (g_data.epfd < 0) {
+    return; // poll() fallback, nothing is registered
+  }
+  struct epoll_event ev = {};
+  ev.events = conn_events(conn);
+  ev.data.fd = conn->fd;
+  if (epoll_ctl(g_data.epfd, op, conn->fd, &ev)) {
+    die("epoll_ctl");
+  }
+}
+
+// switch between read and write interest after `conn->state` has changed.
+// re-arming also reports the fd again if it is already ready.
+void conn_update_events(Conn *conn) {
+  conn_watch(conn, EPOLL_CTL_MOD);
+}
+
 int32_t accept_new_conn(int fd) {
   // accept
   struct sockaddr_in client_addr = {};
   socklen_t socklen  = sizeof(client_addr);
   int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
   if (connfd < 0) {
-    msg("accept() error");
+    if (errno != EAGAIN) {
+      msg("accept() error");
+    }
     return -1;
   }
+  return conn_new(connfd) ? 0 : -1;
+}
 
+// set up a connection for an accepted socket.
+Conn *conn_new(int connfd) {
   // set the new connection fd to nonblocking mode
   fd_set_nb(connfd);
 
   // create Conn
-  struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
+  struct Conn *conn = (struct Conn *)slab_alloc(sizeof(struct Conn));
   if (!conn) {
     close(connfd);
-    return -1;
+    return NULL;
   }
   conn->fd = connfd;
+  conn->id = ++g_data.next_conn_id;
   conn->state = STATE_REQ;
-  conn->rbuf_size = 0;
-  conn->wbuf_size = 0;
-  conn->wbuf_sent = 0;
+  conn->rbuf = Buffer{};
+  conn->wbuf = Buffer{};
+  conn->sending = NULL;
+  conn->aof_wait = false;
+  conn->idle_start = get_monotonic_msec();
   dlist_insert_before(&g_data.idle_list, &conn->idle_list);
   conn_put(g_data.fd2conn, conn);
-  return 0;
+  g_data.stats.conns++;
+  g_data.stats.conns_total++;
+  // register once, the interest is only changed with the state
+  conn_watch(conn, EPOLL_CTL_ADD);
+  return conn;
 }
 
 void connection_io(Conn* conn, void (* req_func)(Conn *), void (* res_func)(Conn *)) {
@@ -80,16 +126,28 @@ void connection_io(Conn* conn, void (* req_func)(Conn *), void (* res_func)(Conn
     req_func(conn);
   } else if (conn->state == STATE_RES) {
     res_func(conn);
+  } else if (conn->state == STATE_WAIT) {
+    // nothing to do until the owning shard responds
   } else {
     assert(0);
   }
 }
 
 void conn_done(Conn *conn) {
+  if (g_data.uring) {
+    // queued SQEs name the fd by number, submit them before it is reused.
+    // a multishot recv holds the socket open, shutdown() terminates it.
+    // an in-flight send owns its buffer and frees it on completion.
+    (void)uring_enter(g_data.uring, 0);
+    (void)shutdown(conn->fd, SHUT_RDWR);
+  }
   (void)close(conn->fd);
   g_data.fd2conn[conn->fd] = NULL;
   dlist_detach(&conn->idle_list);
-  free(conn);
+  buf_free(&conn->rbuf);
+  buf_free(&conn->wbuf);
+  slab_free(conn, sizeof(struct Conn));
+  g_data.stats.conns--;
 }
 
 void init_server_conn() {
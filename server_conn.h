@@ -1,25 +1,29 @@
 #pragma once
 
 #include "linked_list.h"
-
-const size_t k_max_msg = 4096;
+#include "buffer.h"
 
 enum {
   STATE_REQ = 0,
   STATE_RES = 1,
   STATE_END = 2,
+  STATE_WAIT = 3, // waiting for a forwarded request to come back
 };
 
+struct UringSend;
+
 struct Conn {
   int fd = -1;
+  uint64_t id = 0; // unique per shard, fds get reused
   uint32_t state = 0;
   // buffer for reading
-  size_t rbuf_size = 0;
-  uint8_t rbuf[4 + k_max_msg];
+  Buffer rbuf;
   // buffer for writing
-  size_t wbuf_size = 0;
-  size_t wbuf_sent = 0;
-  uint8_t wbuf[4 + k_max_msg];
+  Buffer wbuf;
+  // the send in flight with the io_uring backend
+  UringSend *sending = NULL;
+  // responses held until the AOF is fsynced
+  bool aof_wait = false;
   uint64_t idle_start = 0;
   // timer 
   DList idle_list;
@@ -28,5 +32,7 @@ struct Conn {
 void init_server_conn();
 void fd_set_nb(int fd);
 void connection_io(Conn* conn, void (* req_func)(Conn *), void (* res_func)(Conn *));
+void conn_update_events(Conn *conn);
 void conn_done(Conn *conn);
-int32_t accept_new_conn(int fd);
\ No newline at end of file
+int32_t accept_new_conn(int fd);
+Conn *conn_new(int connfd);
\ No newline at end of file
@@ -1,167 +1,655 @@
 
 #include <math.h>
 #include <time.h>
+#include <new>
+#include <utility>
 #include "server_data.h"
-#include "heap.h"
 #include "server_common.h"
+#include "bio.h"
+#include "slab.h"
+#include "server_shard.h"
+#include "server_evict.h"
 
-static void h_scan(HTab *tab, void (*f)(HNode *, void *), void *arg) {
-  if (tab->size == 0) {
-    return;
+// longer string values get their own allocation
+const uint32_t k_inline_max = 64;
+
+static size_t value_size(uint32_t type, uint8_t flags, uint32_t vlen) {
+  if (type == T_ZSET) {
+    return sizeof(ZSet *);
+  }
+  return sizeof(uint32_t) + ((flags & ENT_EXT) ? sizeof(char *) : vlen);
+}
+
+static size_t entry_size(Entry *ent) {
+  uint32_t vlen = 0;
+  if (ent->type == T_STR) {
+    memcpy(&vlen, entry_value(ent), sizeof(vlen));
+  }
+  return sizeof(Entry) + ((ent->flags & ENT_TTL) ? sizeof(TWTimer) : 0)
+    + ent->klen + value_size(ent->type, ent->flags, vlen);
+}
+
+// entries come from the slab allocator.
+// the value is left for the caller to fill in.
+static Entry *entry_alloc(uint32_t type, uint8_t flags, const char *key,
+  uint32_t klen, uint32_t vlen)
+{
+  flags &= ~ENT_EXT;
+  if (type == T_STR && vlen > k_inline_max) {
+    flags |= ENT_EXT;
+  }
+  size_t size = sizeof(Entry) + ((flags & ENT_TTL) ? sizeof(TWTimer) : 0)
+    + klen + value_size(type, flags, vlen);
+  Entry *ent = new (slab_alloc(size)) Entry();
+  ent->node.hcode = str_hash((uint8_t *)key, klen);
+  ent->klen = klen;
+  ent->type = (uint8_t)type;
+  ent->flags = flags;
+  if (flags & ENT_TTL) {
+    new (entry_timer(ent)) TWTimer();
+  }
+  memcpy(entry_key(ent), key, klen);
+  entry_touch(ent, true);
+  return ent;
+}
+
+static void str_fill(Entry *ent, const char *val, uint32_t vlen) {
+  char *dst = entry_value(ent);
+  memcpy(dst, &vlen, sizeof(vlen));
+  dst += sizeof(vlen);
+  if (ent->flags & ENT_EXT) {
+    char *ext = (char *)slab_alloc(vlen);
+    memcpy(ext, val, vlen);
+    memcpy(dst, &ext, sizeof(ext));
+  } else {
+    memcpy(dst, val, vlen);
+  }
+}
+
+static Entry *entry_new_zset(const char *key, uint32_t klen, uint8_t flags) {
+  Entry *ent = entry_alloc(T_ZSET, flags, key, klen, 0);
+  ZSet *zset = new (slab_alloc(sizeof(ZSet))) ZSet();
+  memcpy(entry_value(ent), &zset, sizeof(zset));
+  return ent;
+}
+
+// a key to look up, without building an entry
+struct LookupKey {
+  SNode node;
+  const char *name = NULL;
+  uint32_t len = 0;
+};
+
+static bool entry_eq(SNode *node, SNode *key) {
+  Entry *ent = container_of(node, Entry, node);
+  LookupKey *lkey = container_of(key, LookupKey, node);
+  return ent->klen == lkey->len && 0 == memcmp(entry_key(ent), lkey->name, lkey->len);
+}
+
+static bool node_same(SNode *node, SNode *key) {
+  return node == key;
+}
+
+static LookupKey lookup_key(const char *name, size_t len) {
+  LookupKey key;
+  key.node.hcode = str_hash((uint8_t *)name, len);
+  key.name = name;
+  key.len = (uint32_t)len;
+  return key;
+}
+
+static bool entry_expired(Entry *ent) {
+  return (ent->flags & ENT_TTL) && tw_armed(entry_timer(ent))
+    && entry_timer(ent)->expire < get_monotonic_msec();
+}
+
+// a key past its ttl is deleted when it is looked up, so it is never
+// seen, even if the active expiry hasn't reached it yet.
+static Entry *db_find(LookupKey *key) {
+  SNode *node = sm_lookup(&g_data.db, &key->node, &entry_eq);
+  if (!node) {
+    return NULL;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  if (entry_expired(ent)) {
+    sm_pop(&g_data.db, node, &node_same);
+    entry_del_async(ent);
+    g_data.stats.expired_keys++;
+    return NULL;
   }
-  for (size_t i = 0; i < tab->mask + 1; ++i) {
-    HNode *node = tab->tab[i];
-    while (node) {
-      f(node, arg);
-      node = node->next;
+  entry_touch(ent, false);
+  return ent;
+}
+
+// a lookup that doesn't expire or touch the key, for the eviction
+Entry *db_peek(const char *name, size_t len) {
+  LookupKey key = lookup_key(name, len);
+  SNode *node = sm_lookup(&g_data.db, &key.node, &entry_eq);
+  return node ? container_of(node, Entry, node) : NULL;
+}
+
+static Entry *db_lookup(std::string_view name) {
+  LookupKey key = lookup_key(name.data(), name.size());
+  return db_find(&key);
+}
+
+static Entry *db_pop_key(LookupKey *key) {
+  SNode *node = sm_pop(&g_data.db, &key->node, &entry_eq);
+  if (!node) {
+    return NULL;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  if (entry_expired(ent)) {
+    entry_del_async(ent);
+    g_data.stats.expired_keys++;
+    return NULL;
+  }
+  return ent;
+}
+
+static Entry *db_pop(const char *name, size_t len) {
+  LookupKey key = lookup_key(name, len);
+  return db_pop_key(&key);
+}
+
+// a lookup is a chain of dependent cache misses: the control bytes,
+// the slot, then the entry. a multi-key command hashes all of its keys
+// first, and prefetches their buckets this many keys ahead of the probes.
+const size_t k_prefetch_dist = 8;
+
+// the keys at cmd[first], cmd[first + step], ...
+static std::vector<LookupKey> batch_keys(Cmd &cmd,
+  size_t first, size_t step)
+{
+  std::vector<LookupKey> keys;
+  keys.reserve((cmd.size() - first + step - 1) / step);
+  for (size_t i = first; i < cmd.size(); i += step) {
+    keys.push_back(lookup_key(cmd[i].data(), cmd[i].size()));
+  }
+  for (size_t i = 0; i < keys.size() && i < k_prefetch_dist; ++i) {
+    sm_prefetch(&g_data.db, keys[i].node.hcode);
+  }
+  return keys;
+}
+
+// called before probing the i-th key
+static void batch_advance(std::vector<LookupKey> &keys, size_t i) {
+  if (i + k_prefetch_dist < keys.size()) {
+    sm_prefetch(&g_data.db, keys[i + k_prefetch_dist].node.hcode);
+  }
+}
+
+// a multi-key command runs on the shard of its first key (see cmd_route()),
+// so with --threads all of its keys must be owned by that shard.
+static bool keys_local(Cmd &cmd, size_t first, size_t step,
+  std::string &out)
+{
+  if (shard_count() == 1) {
+    return true;
+  }
+  for (size_t i = first; i < cmd.size(); i += step) {
+    if (shard_of(cmd[i]) != g_data.shard_id) {
+      out_err(out, ERR_ARG, "keys span shards");
+      return false;
     }
   }
+  return true;
 }
 
-static bool entry_eq(HNode *lhs, HNode *rhs) {
-  struct Entry *le = container_of(lhs, struct Entry, node);
-  struct Entry *re = container_of(rhs, struct Entry, node);
-  return le->key == re->key;
+// put a reallocated entry in the place of the old one,
+// in the db and in the ttl wheel.
+static void entry_replace(Entry *old, Entry *ent) {
+  ent->access = old->access;
+  sm_pop(&g_data.db, &old->node, &node_same);
+  sm_insert(&g_data.db, &ent->node);
+  if ((old->flags & ENT_TTL) && (ent->flags & ENT_TTL)) {
+    tw_move(entry_timer(old), entry_timer(ent));
+  }
 }
 
-static void cb_scan(HNode *node, void *arg) {
+static void cb_scan(SNode *node, void *arg) {
   std::string &out = *(std::string *)arg;
-  out_str(out, container_of(node, Entry, node)->key);
+  Entry *ent = container_of(node, Entry, node);
+  out_str(out, entry_key(ent), ent->klen);
 }
 
-static bool str2dbl(const std::string &s, double &out) {
-  char *endp = NULL;
-  out = strtod(s.c_str(), &endp);
-  return endp == s.c_str() + s.size() && !isnan(out);
+
+// keys
+// every key in one response, blocks the shard on a large db. see scan.
+void do_keys(Cmd &cmd, std::string &out) {
+  (void)cmd;
+  out_arr(out, (uint32_t)sm_size(&g_data.db));
+  sm_foreach(&g_data.db, &cb_scan, &out);
 }
 
-static bool str2int(const std::string &s, int64_t &out) {
-  char *endp = NULL;
-  out = strtoll(s.c_str(), &endp, 10);
-  return endp == s.c_str() + s.size();
+// match a [...] class at pat[*pi] against c, and move *pi past it.
+static bool glob_class(const char *pat, size_t plen, size_t *pi, uint8_t c) {
+  size_t i = *pi + 1;
+  bool neg = i < plen && (pat[i] == '^' || pat[i] == '!');
+  i += neg ? 1 : 0;
+  bool match = false;
+  for (; i < plen && pat[i] != ']'; ++i) {
+    if (pat[i] == '\\' && i + 1 < plen) {
+      ++i;
+    }
+    uint8_t lo = (uint8_t)pat[i], hi = lo;
+    if (i + 2 < plen && pat[i + 1] == '-' && pat[i + 2] != ']') {
+      i += 2;
+      if (pat[i] == '\\' && i + 1 < plen) {
+        ++i;
+      }
+      hi = (uint8_t)pat[i];
+      if (lo > hi) {
+        std::swap(lo, hi);
+      }
+    }
+    match = match || (lo <= c && c <= hi);
+  }
+  *pi = i < plen ? i + 1 : plen; // an unclosed class runs to the end
+  return match != neg;
+}
+
+// glob-style matching with * ? [abc] [^a-z] and \ escapes.
+// only the last * is backtracked to, so it can't go exponential.
+static bool glob_match(const char *pat, size_t plen, const char *s, size_t slen) {
+  size_t p = 0, i = 0;
+  size_t star = (size_t)-1, star_i = 0;
+  while (i < slen) {
+    if (p < plen && pat[p] == '*') {
+      star = ++p;
+      star_i = i;
+      continue;
+    }
+    if (p < plen) {
+      size_t np = p + 1;
+      bool ok = true;
+      if (pat[p] == '[') {
+        np = p;
+        ok = glob_class(pat, plen, &np, (uint8_t)s[i]);
+      } else if (pat[p] == '\\' && p + 1 < plen) {
+        np = p + 2;
+        ok = pat[p + 1] == s[i];
+      } else if (pat[p] != '?') {
+        ok = pat[p] == s[i];
+      }
+      if (ok) {
+        p = np;
+        i++;
+        continue;
+      }
+    }
+    if (star == (size_t)-1) {
+      return false;
+    }
+    // let the last * take one more char
+    p = star;
+    i = ++star_i;
+  }
+  while (p < plen && pat[p] == '*') {
+    p++;
+  }
+  return p == plen;
 }
 
+// the options of scan and zscan
+struct ScanArgs {
+  const std::string_view *match = NULL;
+  int64_t count = 10;
+  int type = -1; // any type
+};
 
-void do_keys(std::vector<std::string> &cmd, std::string &out) {
-  (void)cmd;
-  out_arr(out, (uint32_t)hm_size(&g_data.db));
-  h_scan(&g_data.db.ht1, &cb_scan, &out);
-  h_scan(&g_data.db.ht2, &cb_scan, &out);
+static bool parse_scan_args(Cmd &cmd, size_t i,
+  ScanArgs &args, bool with_type, std::string &out)
+{
+  for (; i < cmd.size(); i += 2) {
+    if (i + 1 >= cmd.size()) {
+      out_err(out, ERR_ARG, "syntax error");
+      return false;
+    }
+    const std::string_view &val = cmd.args[i + 1];
+    if (cmd_is(cmd[i], "match")) {
+      args.match = &val;
+    } else if (cmd_is(cmd[i], "count")) {
+      if (!str2int(val, args.count) || args.count < 1) {
+        out_err(out, ERR_ARG, "expect positive int");
+        return false;
+      }
+    } else if (with_type && cmd_is(cmd[i], "type")) {
+      if (cmd_is(val, "string")) {
+        args.type = T_STR;
+      } else if (cmd_is(val, "zset")) {
+        args.type = T_ZSET;
+      } else {
+        out_err(out, ERR_ARG, "unknown type");
+        return false;
+      }
+    } else {
+      out_err(out, ERR_ARG, "syntax error");
+      return false;
+    }
+  }
+  return true;
 }
 
-void do_get(std::vector<std::string> &cmd, std::string &out) {
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+static bool scan_match(const ScanArgs &args, const char *name, size_t len) {
+  return !args.match || glob_match(args.match->data(), args.match->size(), name, len);
+}
 
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (!node) {
-    return out_nil(out);
+// a scan visits some buckets per call, `count` is the number of items
+// to look at, and this many empty buckets are allowed per item.
+const int64_t k_scan_empty_ratio = 10;
+
+// the scan cursor of the db has the shard in the high bits,
+// the shards are scanned one after another.
+const uint32_t k_scan_shard_shift = 48;
+
+// the shard to run a scan on. a bad cursor goes to the local shard,
+// which rejects it.
+uint32_t scan_shard(std::string_view cursor) {
+  int64_t v = 0;
+  if (!str2int(cursor, v) || v < 0
+    || (uint64_t)v >> k_scan_shard_shift >= shard_count())
+  {
+    return g_data.shard_id;
   }
+  return (uint32_t)((uint64_t)v >> k_scan_shard_shift);
+}
 
-  
+// the items found so far
+struct ScanCtx {
+  const ScanArgs *args;
+  std::string items;
+  uint32_t n = 0;
+  int64_t seen = 0;
+};
+
+static void cb_db_scan(SNode *node, void *arg) {
+  ScanCtx *ctx = (ScanCtx *)arg;
   Entry *ent = container_of(node, Entry, node);
+  ctx->seen++;
+  if (!entry_expired(ent)
+    && (ctx->args->type < 0 || ctx->args->type == ent->type)
+    && scan_match(*ctx->args, entry_key(ent), ent->klen))
+  {
+    out_str(ctx->items, entry_key(ent), ent->klen);
+    ctx->n++;
+  }
+}
+
+// scan cursor [match pattern] [count n] [type string|zset]
+// returns [next cursor, [keys...]], the scan is done when the cursor is 0.
+// a key present for the whole scan is returned at least once, even as
+// the db is resized in between.
+void do_scan(Cmd &cmd, std::string &out) {
+  ScanArgs args;
+  int64_t cursor = 0;
+  if (!str2int(cmd[1], cursor) || cursor < 0
+    || (uint64_t)cursor >> k_scan_shard_shift != g_data.shard_id)
+  {
+    return out_err(out, ERR_ARG, "invalid cursor");
+  }
+  if (!parse_scan_args(cmd, 2, args, true, out)) {
+    return;
+  }
+  ScanCtx ctx;
+  ctx.args = &args;
+  uint64_t v = (uint64_t)cursor & ((1ull << k_scan_shard_shift) - 1);
+  int64_t budget = args.count * k_scan_empty_ratio;
+  do {
+    v = sm_scan(&g_data.db, v, &cb_db_scan, &ctx);
+  } while (v && ctx.seen < args.count && --budget > 0);
+
+  uint64_t next = v | ((uint64_t)g_data.shard_id << k_scan_shard_shift);
+  if (v == 0) {
+    // continue with the next shard
+    uint32_t shard = g_data.shard_id + 1;
+    next = shard < shard_count() ? (uint64_t)shard << k_scan_shard_shift : 0;
+  }
+  out_arr(out, 2);
+  out_int(out, (int64_t)next);
+  out_arr(out, ctx.n);
+  out.append(ctx.items);
+}
+
+void do_get(Cmd &cmd, std::string &out) {
+  Entry *ent = db_lookup(cmd[1]);
+  if (!ent) {
+    return out_nil(out);
+  }
+  
   if (ent->type != T_STR) {
     return out_err(out, ERR_TYPE, "expect string type");
   }
-  const std::string &val = container_of(node, Entry, node)->val;
-  out_str(out, val);
+  uint32_t len = 0;
+  const char *val = entry_str(ent, &len);
+  out_str(out, val, len);
+}
+
+static void entry_destroy(Entry *ent);
+
+// replace a string value. an inline value of another size
+// doesn't fit, so the entry is reallocated.
+static void entry_set_str(Entry *ent, std::string_view val) {
+  uint32_t vlen = (uint32_t)val.size();
+  uint32_t old_len = 0;
+  char *old = (char *)entry_str(ent, &old_len);
+  bool ext = vlen > k_inline_max;
+  if (ext && (ent->flags & ENT_EXT)) {
+    slab_free(old, old_len);
+    str_fill(ent, val.data(), vlen);
+    return;
+  }
+  if (!ext && !(ent->flags & ENT_EXT) && vlen == old_len) {
+    memcpy(old, val.data(), vlen);
+    return;
+  }
+  Entry *nent = entry_alloc(T_STR, ent->flags, entry_key(ent), ent->klen, vlen);
+  str_fill(nent, val.data(), vlen);
+  entry_replace(ent, nent);
+  entry_destroy(ent);
 }
 
-void do_set(std::vector<std::string> &cmd, std::string &out) {
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+static void str_insert(std::string_view key, std::string_view val) {
+  Entry *ent = entry_alloc(T_STR, 0, key.data(), (uint32_t)key.size(), (uint32_t)val.size());
+  str_fill(ent, val.data(), (uint32_t)val.size());
+  sm_insert(&g_data.db, &ent->node);
+}
 
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (node) {
-    Entry *ent = container_of(node, Entry, node);
+void do_set(Cmd &cmd, std::string &out) {
+  Entry *ent = db_lookup(cmd[1]);
+  if (ent) {
     if (ent->type != T_STR) {
       return out_err(out, ERR_TYPE, "expect string type");
     }
-    ent->val.swap(cmd[2]);
+    entry_set_str(ent, cmd[2]);
   } else {
-    Entry *ent = new Entry();
-    ent->key.swap(key.key);
-    ent->node.hcode = key.node.hcode;
-    ent->val.swap(cmd[2]);
-    hm_insert(&g_data.db, &ent->node);
+    str_insert(cmd[1], cmd[2]);
   }
 
   out_nil(out);
 }
 
-void heap_delete(std::vector<HeapItem> &a, size_t pos) {
-  // swap erased item with last ietms
-  a[pos] = a.back();
-  a.pop_back();
-  // update swapped item
-  if (pos < a.size()) {
-      heap_update(a.data(), pos, a.size());
+// mget key [key...]
+// a missing key or one of another type is nil.
+void do_mget(Cmd &cmd, std::string &out) {
+  if (!keys_local(cmd, 1, 1, out)) {
+    return;
+  }
+  std::vector<LookupKey> keys = batch_keys(cmd, 1, 1);
+  std::vector<Entry *> ents(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    batch_advance(keys, i);
+    ents[i] = db_find(&keys[i]);
+    if (ents[i]) {
+      __builtin_prefetch(ents[i]); // read after the probes
+    }
+  }
+  out_arr(out, (uint32_t)ents.size());
+  for (Entry *ent : ents) {
+    if (ent && ent->type == T_STR) {
+      uint32_t len = 0;
+      const char *val = entry_str(ent, &len);
+      out_str(out, val, len);
+    } else {
+      out_nil(out);
+    }
   }
 }
 
-void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t) {
-  if (pos < a.size()) {
-    // update
-    a[pos] = t;
-  } else {
-    // append
-    pos = a.size();
-    a.push_back(t);
+// mset key value [key value...]
+// unlike set, a key of another type is replaced, so it can't fail halfway.
+void do_mset(Cmd &cmd, std::string &out) {
+  if (!keys_local(cmd, 1, 2, out)) {
+    return;
   }
-  heap_update(a.data(), pos, a.size());
+  std::vector<LookupKey> keys = batch_keys(cmd, 1, 2);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    batch_advance(keys, i);
+    std::string_view val = cmd[2 + 2 * i];
+    Entry *ent = db_find(&keys[i]);
+    if (ent && ent->type != T_STR) {
+      sm_pop(&g_data.db, &ent->node, &node_same);
+      entry_del_async(ent);
+      ent = NULL;
+    }
+    if (ent) {
+      entry_set_str(ent, val);
+    } else {
+      str_insert(cmd[1 + 2 * i], val);
+    }
+  }
+  out_nil(out);
 }
 
-static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
-  if (ttl_ms < 0 && ent->heap_idx != (size_t)-1) {
-    // remove ttl
-    heap_delete(g_data.heap, ent->heap_idx);
-    ent->heap_idx = -1;
-  } else if (ttl_ms >= 0) {
-    uint64_t expire_at = get_monotonic_msec() + (uint64_t)ttl_ms;
-    HeapItem item = {expire_at, &ent->heap_idx};
-    heap_upsert(g_data.heap, ent->heap_idx, item);
+// keys without a ttl have no timer, it is added on the first one
+static Entry *entry_add_ttl_slot(Entry *ent) {
+  uint32_t vlen = 0;
+  if (ent->type == T_STR) {
+    entry_str(ent, &vlen);
+  }
+  Entry *nent = entry_alloc(ent->type, ent->flags | ENT_TTL, entry_key(ent),
+    ent->klen, vlen);
+  // the value moves as it is, an external string or a zset is not copied
+  memcpy(entry_value(nent), entry_value(ent), value_size(ent->type, ent->flags, vlen));
+  entry_replace(ent, nent);
+  slab_free(ent, entry_size(ent));
+  return nent;
+}
 
+static Entry *entry_set_ttl(Entry *ent, int64_t ttl_ms) {
+  if (ttl_ms < 0) {
+    // remove ttl
+    if (ent->flags & ENT_TTL) {
+      tw_del(&g_data.ttl_wheel, entry_timer(ent));
+    }
+    return ent;
   }
+  if (!(ent->flags & ENT_TTL)) {
+    ent = entry_add_ttl_slot(ent);
+  }
+  uint64_t expire_at = get_monotonic_msec() + (uint64_t)ttl_ms;
+  tw_add(&g_data.ttl_wheel, entry_timer(ent), expire_at);
+  return ent;
 }
 
-void entry_del(Entry *ent) {
+static void entry_destroy(Entry *ent) {
   switch (ent->type) {
-    case T_ZSET:
-      zset_dispose(ent->zset);
-      delete ent->zset;
+    case T_STR:
+      if (ent->flags & ENT_EXT) {
+        uint32_t vlen = 0;
+        char *val = (char *)entry_str(ent, &vlen);
+        slab_free(val, vlen);
+      }
+      break;
+    case T_ZSET: {
+      ZSet *zset = entry_zset(ent);
+      zset_dispose(zset);
+      zset->~ZSet();
+      slab_free(zset, sizeof(ZSet));
       break;
+    }
   }
-  // remove ttl from heap.
+  slab_free(ent, entry_size(ent));
+}
+
+static void bio_entry_destroy(void *arg) {
+  entry_destroy((Entry *)arg);
+}
+
+void entry_del(Entry *ent) {
+  // remove ttl from the wheel.
   entry_set_ttl(ent, -1);
-  delete ent;
+  entry_destroy(ent);
 }
 
-void do_del(std::vector<std::string> cmd, std::string &out) {
-  Entry  key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+// values with more allocations than this are freed in the background
+const size_t k_lazy_free_min = 64;
 
-  HNode *node = hm_pop(&g_data.db, &key.node, &entry_eq);
-  if (node) {
-    entry_del(container_of(node, Entry, node));
+// like entry_del(), but a large value is handed to the bio thread,
+// so a zset with millions of members doesn't stall the event loop.
+void entry_del_async(Entry *ent) {
+  entry_set_ttl(ent, -1);
+  size_t effort = ent->type == T_ZSET ? sm_size(&entry_zset(ent)->hmap) : 1;
+  if (effort > k_lazy_free_min) {
+    bio_submit(&bio_entry_destroy, ent);
+  } else {
+    entry_destroy(ent);
   }
+}
 
-  out_int(out, node ? 1 : 0);
+static bool key_del(std::string_view name, bool async) {
+  Entry *ent = db_pop(name.data(), name.size());
+  if (ent) {
+    if (async) {
+      entry_del_async(ent);
+    } else {
+      entry_del(ent);
+    }
+  }
+  return ent != NULL;
+}
+
+void do_del(Cmd &cmd, std::string &out) {
+  out_int(out, key_del(cmd[1], g_config.lazyfree_del) ? 1 : 0);
 }
 
-bool expect_zset(std::string &out, std::string &s, Entry **ent) {
-  Entry key;
-  key.key.swap(s);
-  key.node.hcode = str_hash((uint8_t *) key.key.data(), key.key.size());
-  HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (!hnode) {
+// mdel key [key...]
+// returns the number of keys deleted.
+void do_mdel(Cmd &cmd, std::string &out) {
+  if (!keys_local(cmd, 1, 1, out)) {
+    return;
+  }
+  std::vector<LookupKey> keys = batch_keys(cmd, 1, 1);
+  int64_t n = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    batch_advance(keys, i);
+    Entry *ent = db_pop_key(&keys[i]);
+    if (!ent) {
+      continue;
+    }
+    if (g_config.lazyfree_del) {
+      entry_del_async(ent);
+    } else {
+      entry_del(ent);
+    }
+    n++;
+  }
+  out_int(out, n);
+}
+
+// unlink key
+// removes the key in O(1), the memory is reclaimed in the background.
+void do_unlink(Cmd &cmd, std::string &out) {
+  out_int(out, key_del(cmd[1], true) ? 1 : 0);
+}
+
+bool expect_zset(std::string &out, std::string_view s, Entry **ent) {
+  *ent = db_lookup(s);
+  if (!*ent) {
     out_nil(out);
     return false;
   } 
 
-  *ent = container_of(hnode, Entry, node);
   if ((*ent)->type != T_ZSET) {
     out_err(out, ERR_TYPE, "expect zset");
     return false;
@@ -169,76 +657,100 @@ bool expect_zset(std::string &out, std::string &s, Entry **ent) {
   return true;
 }
 
-// zadd zset score name
-void do_zadd(std::vector<std::string> &cmd, std::string &out) {
-  double score = 0;
-  if (!str2dbl(cmd[2], score)) {
-    return out_err(out, ERR_ARG, "expect fp number");
+// prefetch the name of the zset command `k_prefetch_dist` names after i
+static void zbatch_advance(ZSet *zset, Cmd &cmd,
+  size_t i, size_t step)
+{
+  size_t next = i + k_prefetch_dist * step;
+  if (next < cmd.size()) {
+    zset_prefetch(zset, cmd[next].data(), cmd[next].size());
   }
+}
 
-  // look up or create the zset
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-  HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
+// zadd zset score name [score name...]
+// returns the number of names added, the others have their scores updated.
+void do_zadd(Cmd &cmd, std::string &out) {
+  // all scores are checked before anything is changed
+  std::vector<double> scores;
+  for (size_t i = 2; i < cmd.size(); i += 2) {
+    double score = 0;
+    if (!str2dbl(cmd[i], score)) {
+      return out_err(out, ERR_ARG, "expect fp number");
+    }
+    scores.push_back(score);
+  }
 
-  Entry *ent = NULL;
-  if (!hnode) {
-    ent = new Entry();
-    ent->key.swap(key.key);
-    ent->node.hcode = key.node.hcode;
-    ent->type = T_ZSET;
-    ent->zset = new ZSet();
-    hm_insert(&g_data.db, &ent->node);
+  // look up or create the zset
+  Entry *ent = db_lookup(cmd[1]);
+  if (!ent) {
+    ent = entry_new_zset(cmd[1].data(), (uint32_t)cmd[1].size(), 0);
+    sm_insert(&g_data.db, &ent->node);
   } else {
-    ent = container_of(hnode, Entry, node);
     if (ent->type != T_ZSET) {
       return out_err(out, ERR_TYPE, "expect zset");
     }
   }
 
-  // add or udpate the tuple
-  const std::string &name = cmd[3];
-  bool added = zset_add(ent->zset, name.data(), name.size(), score);
-  return out_int(out, (int64_t)added);
+  // add or udpate the tuples
+  ZSet *zset = entry_zset(ent);
+  int64_t added = 0;
+  for (size_t i = 3; i < cmd.size(); i += 2) {
+    zbatch_advance(zset, cmd, i, 2);
+    std::string_view name = cmd[i];
+    added += zset_add(zset, name.data(), name.size(), scores[i / 2 - 1]) ? 1 : 0;
+  }
+  return out_int(out, added);
 }
 
-// zrem zset name
-void do_zrem(std::vector<std::string> &cmd, std::string &out) {
+// zrem zset name [name...]
+// returns the number of names removed.
+void do_zrem(Cmd &cmd, std::string &out) {
   Entry *ent = NULL;
   if (!expect_zset(out, cmd[1], &ent)) {
     return;
   }
 
-  const std::string &name = cmd[2];
-  ZNode *znode = zset_pop(ent->zset, name.data(), name.size());
-  if (znode) {
-    znode_del(znode);
+  ZSet *zset = entry_zset(ent);
+  int64_t removed = 0;
+  for (size_t i = 2; i < cmd.size(); ++i) {
+    zbatch_advance(zset, cmd, i, 1);
+    ZNode *znode = zset_pop(zset, cmd[i].data(), cmd[i].size());
+    if (znode) {
+      znode_del(znode);
+      removed++;
+    }
   }
-  return out_int(out, znode ? 1 : 0);
+  return out_int(out, removed);
 }
 
-//zscore zset name
-void do_zscore(std::vector<std::string> &cmd, std::string &out) {
+//zscore zset name [name...]
+// with more than one name, an array of scores or nils.
+void do_zscore(Cmd &cmd, std::string &out) {
   Entry *ent = NULL;
   if (!expect_zset(out, cmd[1], &ent)) {
     return;
   }
 
-  const std::string &name = cmd[2];
-  ZNode *znode = zset_lookup(ent->zset, name.data(), name.size());
-  return znode ? out_dbl(out, znode->score) : out_nil(out);
+  ZSet *zset = entry_zset(ent);
+  if (cmd.size() > 3) {
+    out_arr(out, (uint32_t)(cmd.size() - 2));
+  }
+  for (size_t i = 2; i < cmd.size(); ++i) {
+    zbatch_advance(zset, cmd, i, 1);
+    ZNode *znode = zset_lookup(zset, cmd[i].data(), cmd[i].size());
+    znode ? out_dbl(out, znode->score) : out_nil(out);
+  }
 }
 
 // zquery key score name offset limit
-void do_zquery(std::vector<std::string> &cmd, std::string &out) {
+void do_zquery(Cmd &cmd, std::string &out) {
     // parse args
     double score = 0;
     if (!str2dbl(cmd[2], score)) {
       return out_err(out, ERR_ARG, "expect fp number");
     }
 
-    const std::string &name = cmd[3];
+    std::string_view name = cmd[3];
     int64_t offset = 0;
     int64_t limit = 0;
     if (!str2int(cmd[4], offset)) {
@@ -263,35 +775,281 @@ void do_zquery(std::vector<std::string> &cmd, std::string &out) {
     }
     
     // 1. seek
-    ZNode *znode = zset_query(ent->zset, score, name.data(), name.size());
+    ZSet *zset = entry_zset(ent);
+    ZNode *znode = zset_query(zset, score, name.data(), name.size());
     // 2. offste
-    znode = znode_offset(znode, offset);
+    znode = znode_offset(zset, znode, offset);
     // 3. iterate and output
     void *arr = begin_arr(out);
     uint32_t n = 0;
     while (znode && (int64_t)n < limit) {
         out_str(out, znode->name, znode->len);
         out_dbl(out, znode->score);
-        znode = znode_offset(znode, +1); // successor
+        znode = znode_offset(zset, znode, +1); // successor
         n += 2;
     }
     end_arr(out, arr, n);
 }
 
-void do_expire(std::vector<std::string> &cmd, std::string &out) {
+static void cb_zscan(ZNode *znode, void *arg) {
+  ScanCtx *ctx = (ScanCtx *)arg;
+  ctx->seen++;
+  if (scan_match(*ctx->args, znode->name, znode->len)) {
+    out_str(ctx->items, znode->name, znode->len);
+    out_dbl(ctx->items, znode->score);
+    ctx->n += 2;
+  }
+}
+
+// zscan key cursor [match pattern] [count n]
+// returns [next cursor, [name, score, ...]], like scan.
+void do_zscan(Cmd &cmd, std::string &out) {
+  ScanArgs args;
+  int64_t cursor = 0;
+  if (!str2int(cmd[2], cursor) || cursor < 0) {
+    return out_err(out, ERR_ARG, "invalid cursor");
+  }
+  if (!parse_scan_args(cmd, 3, args, false, out)) {
+    return;
+  }
+  Entry *ent = NULL;
+  if (!expect_zset(out, cmd[1], &ent)) {
+    if (out[0] == SER_NIL) {
+      out.clear();
+      out_arr(out, 2);
+      out_int(out, 0);
+      out_arr(out, 0);
+    }
+    return;
+  }
+  ScanCtx ctx;
+  ctx.args = &args;
+  uint64_t v = (uint64_t)cursor;
+  int64_t budget = args.count * k_scan_empty_ratio;
+  do {
+    v = zset_scan(entry_zset(ent), v, &cb_zscan, &ctx);
+  } while (v && ctx.seen < args.count && --budget > 0);
+
+  out_arr(out, 2);
+  out_int(out, (int64_t)v);
+  out_arr(out, ctx.n);
+  out.append(ctx.items);
+}
+
+// a missing key is an empty zset for the commands below.
+// returns NULL after writing the response for a missing key or an error.
+static ZSet *expect_zset_or(std::string &out, std::string_view s,
+  void (*empty)(std::string &))
+{
+  Entry *ent = NULL;
+  if (!expect_zset(out, s, &ent)) {
+    if (out[0] == SER_NIL) {
+      out.clear();
+      empty(out);
+    }
+    return NULL;
+  }
+  return entry_zset(ent);
+}
+
+static void out_zero(std::string &out) {
+  out_int(out, 0);
+}
+
+static void out_empty_arr(std::string &out) {
+  out_arr(out, 0);
+}
+
+// zcard key
+void do_zcard(Cmd &cmd, std::string &out) {
+  ZSet *zset = expect_zset_or(out, cmd[1], &out_zero);
+  if (zset) {
+    out_int(out, (int64_t)zset_size(zset));
+  }
+}
+
+// zrank key name, zrevrank key name
+// the 0-based position by score, from the lowest or from the highest.
+void do_zrank(Cmd &cmd, std::string &out) {
+  Entry *ent = NULL;
+  if (!expect_zset(out, cmd[1], &ent)) {
+    return;
+  }
+  ZSet *zset = entry_zset(ent);
+  std::string_view name = cmd[2];
+  ZNode *znode = zset_lookup(zset, name.data(), name.size());
+  if (!znode) {
+    return out_nil(out);
+  }
+  int64_t rank = zset_rank(zset, znode);
+  if (cmd_is(cmd[0], "zrevrank")) {
+    rank = (int64_t)zset_size(zset) - 1 - rank;
+  }
+  out_int(out, rank);
+}
+
+// zrange key start stop [withscores]
+// members by rank, inclusive. negative ranks count from the end.
+void do_zrange(Cmd &cmd, std::string &out) {
+  int64_t start = 0;
+  int64_t stop = 0;
+  if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+    return out_err(out, ERR_ARG, "expect int");
+  }
+  bool with_scores = cmd.size() == 5;
+  if (with_scores && !cmd_is(cmd[4], "withscores")) {
+    return out_err(out, ERR_ARG, "syntax error");
+  }
+  ZSet *zset = expect_zset_or(out, cmd[1], &out_empty_arr);
+  if (!zset) {
+    return;
+  }
+  int64_t size = (int64_t)zset_size(zset);
+  if (start < 0) {
+    start = start + size < 0 ? 0 : start + size;
+  }
+  if (stop < 0) {
+    stop += size;
+  }
+  if (stop >= size) {
+    stop = size - 1;
+  }
+  if (start > stop) {
+    return out_arr(out, 0);
+  }
+  // seek by rank, then iterate
+  void *arr = begin_arr(out);
+  uint32_t n = 0;
+  ZNode *znode = zset_select(zset, start);
+  for (int64_t i = start; znode && i <= stop; ++i) {
+    out_str(out, znode->name, znode->len);
+    n++;
+    if (with_scores) {
+      out_dbl(out, znode->score);
+      n++;
+    }
+    znode = znode_offset(zset, znode, +1);
+  }
+  end_arr(out, arr, n);
+}
+
+// a score bound, exclusive with a leading '('
+static bool str2bound(std::string_view s, double &score, bool &excl) {
+  excl = !s.empty() && s[0] == '(';
+  return str2dbl(excl ? s.substr(1) : s, score);
+}
+
+// the rank of the first member with a score >= `score`, or above it
+static int64_t zset_score_rank(ZSet *zset, double score, bool above) {
+  if (above) {
+    if (score == INFINITY) {
+      return (int64_t)zset_size(zset);
+    }
+    score = nextafter(score, INFINITY);
+  }
+  ZNode *znode = zset_query(zset, score, "", 0);
+  return znode ? zset_rank(zset, znode) : (int64_t)zset_size(zset);
+}
+
+// zcount key min max
+// the number of members with min <= score <= max, by two rank lookups.
+void do_zcount(Cmd &cmd, std::string &out) {
+  double lo = 0, hi = 0;
+  bool lo_excl = false, hi_excl = false;
+  if (!str2bound(cmd[2], lo, lo_excl) || !str2bound(cmd[3], hi, hi_excl)) {
+    return out_err(out, ERR_ARG, "expect fp number");
+  }
+  ZSet *zset = expect_zset_or(out, cmd[1], &out_zero);
+  if (!zset) {
+    return;
+  }
+  int64_t begin = zset_score_rank(zset, lo, lo_excl);
+  int64_t end = zset_score_rank(zset, hi, !hi_excl);
+  out_int(out, end > begin ? end - begin : 0);
+}
+
+void do_expire(Cmd &cmd, std::string &out) {
   // parse args
   int64_t ttl_ms = 0;
   if (!str2int(cmd[2], ttl_ms)) {
     return out_err(out, ERR_ARG, "expect int64");
   }
   // lookup the key.
-  Entry key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-  if (node) {
-    Entry *ent = container_of(node, Entry, node);
+  Entry *ent = db_lookup(cmd[1]);
+  if (ent) {
     entry_set_ttl(ent, ttl_ms);
   }
-  return out_int(out, node ? 1 : 0);
-}
\ No newline at end of file
+  return out_int(out, ent ? 1 : 0);
+}
+
+// pexpireat key unix_ms
+// the absolute form of ttl, used by the AOF so a replay doesn't extend ttls.
+void do_pexpireat(Cmd &cmd, std::string &out) {
+  int64_t at_ms = 0;
+  if (!str2int(cmd[2], at_ms)) {
+    return out_err(out, ERR_ARG, "expect int64");
+  }
+  Entry *ent = db_lookup(cmd[1]);
+  if (ent) {
+    entry_set_expire_at(ent, at_ms);
+  }
+  return out_int(out, ent ? 1 : 0);
+}
+
+// returns the entry, which may have been reallocated.
+Entry *entry_set_expire_at(Entry *ent, int64_t at_ms) {
+  int64_t ttl_ms = at_ms - (int64_t)get_wall_msec();
+  return entry_set_ttl(ent, ttl_ms < 0 ? 0 : ttl_ms);
+}
+
+// the expiration time as unix milliseconds, -1 if the key has no ttl.
+int64_t entry_expire_at(Entry *ent) {
+  if (!(ent->flags & ENT_TTL) || !tw_armed(entry_timer(ent))) {
+    return -1;
+  }
+  int64_t ttl_ms = (int64_t)entry_timer(ent)->expire
+    - (int64_t)get_monotonic_msec();
+  return (int64_t)get_wall_msec() + (ttl_ms < 0 ? 0 : ttl_ms);
+}
+
+// add a key for the snapshot loader, replacing an existing one.
+// a string gets the value `val`, a zset is created empty.
+// `at_ms` is the expiration time in unix ms, or -1.
+Entry *entry_load(const char *key, uint32_t klen, uint32_t type,
+  const char *val, uint32_t vlen, int64_t at_ms)
+{
+  Entry *old = db_pop(key, klen);
+  if (old) {
+    entry_del(old);
+  }
+  // with the ttl slot up front, so it isn't reallocated for it
+  uint8_t flags = at_ms >= 0 ? ENT_TTL : 0;
+  Entry *ent = NULL;
+  if (type == T_STR) {
+    ent = entry_alloc(T_STR, flags, key, klen, vlen);
+    str_fill(ent, val, vlen);
+  } else {
+    ent = entry_new_zset(key, klen, flags);
+  }
+  sm_insert(&g_data.db, &ent->node);
+  if (at_ms >= 0) {
+    entry_set_expire_at(ent, at_ms);
+  }
+  return ent;
+}
+
+struct ForeachCtx {
+  void (*f)(Entry *, void *);
+  void *arg;
+};
+
+static void cb_foreach(SNode *node, void *arg) {
+  ForeachCtx *ctx = (ForeachCtx *)arg;
+  ctx->f(container_of(node, Entry, node), ctx->arg);
+}
+
+// visit every key of this shard.
+void db_foreach(void (*f)(Entry *, void *), void *arg) {
+  ForeachCtx ctx = {f, arg};
+  sm_foreach(&g_data.db, &cb_foreach, &ctx);
+}
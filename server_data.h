@@ -4,8 +4,10 @@
 #include <vector>
 
 #include "common.h"
-#include "hashtable.h"
+#include "swisstable.h"
+#include "timewheel.h"
 #include "zset.h"
+#include "server_cmd.h"
 #include "server_out.h"
 
 enum {
@@ -18,32 +20,94 @@ enum {
   ERR_2BIG = 2,
   ERR_TYPE = 3,
   ERR_ARG = 4,
+  ERR_OOM = 5, // over maxmemory, see server_evict.h
 };
 
-// structure for the key 
+enum {
+  ENT_TTL = 1, // has a ttl timer
+  ENT_EXT = 2, // the string value is in its own allocation
+};
+
+// a key and its value in a single allocation:
+//   [Entry][TWTimer, with ENT_TTL][key][value]
+// the value is a tagged union on `type` and ENT_EXT:
+//   T_STR:           [vlen: u32][bytes]
+//   T_STR, ENT_EXT:  [vlen: u32][char *]
+//   T_ZSET:          [ZSet *]
+// fields after the key are unaligned. an entry is reallocated when it
+// gets its first ttl or an inline value changes size, so an Entry *
+// is not stable across the commands that do that.
 struct Entry {
-  struct HNode node;
-  std::string key;
-  // for ttl.
-  size_t heap_idx = -1; // index to the ttl heap.
-  uint32_t type = 0;
-  std::string val; // string 
-  ZSet *zset = NULL; // sorted set
+  SNode node;
+  uint32_t klen = 0;
+  uint8_t type = 0;
+  uint8_t flags = 0;
+  uint16_t access = 0; // the lru or lfu clock, see entry_touch()
+  alignas(TWTimer) char data[0]; // the timer, if any, comes first
 };
 
+// the ttl timer, only with ENT_TTL.
+inline TWTimer *entry_timer(Entry *ent) {
+  return (TWTimer *)ent->data;
+}
+
+inline Entry *entry_from_timer(TWTimer *timer) {
+  return (Entry *)((char *)timer - offsetof(Entry, data));
+}
+
+inline char *entry_key(Entry *ent) {
+  return ent->data + ((ent->flags & ENT_TTL) ? sizeof(TWTimer) : 0);
+}
+
+inline char *entry_value(Entry *ent) {
+  return entry_key(ent) + ent->klen;
+}
+
+inline const char *entry_str(Entry *ent, uint32_t *len) {
+  const char *val = entry_value(ent);
+  memcpy(len, val, sizeof(uint32_t));
+  val += sizeof(uint32_t);
+  if (ent->flags & ENT_EXT) {
+    memcpy(&val, val, sizeof(char *));
+  }
+  return val;
+}
+
+inline ZSet *entry_zset(Entry *ent) {
+  ZSet *zset = NULL;
+  memcpy(&zset, entry_value(ent), sizeof(zset));
+  return zset;
+}
 
-void do_keys(std::vector<std::string> &cmd, std::string &out);
-void do_get(std::vector<std::string> &cmd, std::string &out);
-void do_set(std::vector<std::string> &cmd, std::string &out);
-void do_del(std::vector<std::string> cmd, std::string &out);
-bool expect_zset(std::string &out, std::string &s, Entry **ent);
-void do_zadd(std::vector<std::string> &cmd, std::string &out);
-void do_zrem(std::vector<std::string> &cmd, std::string &out);
-void do_zscore(std::vector<std::string> &cmd, std::string &out);
-void do_zquery(std::vector<std::string> &cmd, std::string &out);
-void do_expire(std::vector<std::string> &cmd, std::string &out);
+void do_keys(Cmd &cmd, std::string &out);
+uint32_t scan_shard(std::string_view cursor);
+void do_scan(Cmd &cmd, std::string &out);
+void do_get(Cmd &cmd, std::string &out);
+void do_set(Cmd &cmd, std::string &out);
+void do_mget(Cmd &cmd, std::string &out);
+void do_mset(Cmd &cmd, std::string &out);
+void do_del(Cmd &cmd, std::string &out);
+void do_mdel(Cmd &cmd, std::string &out);
+void do_unlink(Cmd &cmd, std::string &out);
+bool expect_zset(std::string &out, std::string_view s, Entry **ent);
+void do_zadd(Cmd &cmd, std::string &out);
+void do_zrem(Cmd &cmd, std::string &out);
+void do_zscore(Cmd &cmd, std::string &out);
+void do_zquery(Cmd &cmd, std::string &out);
+void do_zscan(Cmd &cmd, std::string &out);
+void do_zcard(Cmd &cmd, std::string &out);
+void do_zrank(Cmd &cmd, std::string &out);
+void do_zrange(Cmd &cmd, std::string &out);
+void do_zcount(Cmd &cmd, std::string &out);
+void do_expire(Cmd &cmd, std::string &out);
+void do_pexpireat(Cmd &cmd, std::string &out);
 void *begin_arr(std::string &out);
 void end_arr(std::string &out, void *ctx, uint32_t n);
-void heap_delete(std::vector<HeapItem> &a, size_t pos);
-void heap_upsert(std::vector<HeapItem> &a, size_t pos, HeapItem t);
-void entry_del(Entry *ent);
\ No newline at end of file
+void entry_del(Entry *ent);
+void entry_del_async(Entry *ent);
+int64_t entry_expire_at(Entry *ent);
+Entry *entry_set_expire_at(Entry *ent, int64_t at_ms);
+Entry *entry_load(const char *key, uint32_t klen, uint32_t type,
+  const char *val, uint32_t vlen, int64_t at_ms);
+Entry *db_peek(const char *name, size_t len);
+void db_foreach(void (*f)(Entry *, void *), void *arg);
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include <string>
+#include <vector>
+#include "server_evict.h"
+#include "server_common.h"
+#include "server_shard.h"
+#include "slab.h"
+
+// a few keys are sampled per victim. the better candidates stay in a pool
+// across the samples, so the victims are close to the ones an exact lru
+// would pick. the pool keeps key names, not entries, which may be deleted
+// or reallocated in the meantime.
+const size_t k_evict_samples = 5;
+const size_t k_evict_pool = 16;
+// samples to try before giving up on finding a key with a ttl,
+// or one not used in the current tick of the clock
+const uint32_t k_evict_tries = 16;
+// an eviction pass runs for this long, then leaves the rest to the next
+// loop iteration
+const uint64_t k_evict_budget_us = 1000;
+const uint32_t k_evict_batch = 16; // keys between clock reads
+
+// lfu: a logarithmic access counter in the high byte, the minute of the
+// last decay in the low byte. the counter loses 1 per minute of idleness,
+// and a new key starts above 0 so it isn't the first one evicted.
+const uint32_t k_lfu_init = 5;
+const uint32_t k_lfu_log_factor = 10;
+
+static thread_local uint64_t t_rand = 0x9e3779b97f4a7c15;
+// the last pass ran out of time, not out of memory to free
+static thread_local bool t_evict_more = false;
+
+struct EvictCand {
+  uint64_t score = 0;
+  std::string key;
+};
+
+// sorted by score, the best victim last
+static thread_local std::vector<EvictCand> t_pool;
+
+static uint64_t evict_rand() {
+  // xorshift64
+  t_rand ^= t_rand << 13;
+  t_rand ^= t_rand >> 7;
+  t_rand ^= t_rand << 17;
+  return t_rand;
+}
+
+// lru: the access time in seconds, wrapping after 18 hours
+static uint16_t lru_clock() {
+  return (uint16_t)(get_monotonic_msec() / 1000);
+}
+
+static uint8_t lfu_minutes() {
+  return (uint8_t)(get_monotonic_msec() / 60000);
+}
+
+static uint32_t lfu_counter(Entry *ent) {
+  uint32_t counter = ent->access >> 8;
+  uint8_t idle = (uint8_t)(lfu_minutes() - (ent->access & 0xff));
+  return counter > idle ? counter - idle : 0;
+}
+
+// update the clock of a key that was accessed, or just created.
+// the counter is incremented with a probability of 1 / (n * factor + 1),
+// so 255 is reached after about a million accesses.
+void entry_touch(Entry *ent, bool created) {
+  if (g_config.maxmemory == 0) {
+    return;
+  }
+  if (g_config.evict_policy == EVICT_ALLKEYS_LRU) {
+    ent->access = lru_clock();
+  } else if (g_config.evict_policy == EVICT_ALLKEYS_LFU) {
+    uint32_t counter = created ? k_lfu_init : lfu_counter(ent);
+    uint32_t base = counter > k_lfu_init ? counter - k_lfu_init : 0;
+    if (!created && counter < 255
+      && evict_rand() % (base * k_lfu_log_factor + 1) == 0)
+    {
+      counter++;
+    }
+    ent->access = (uint16_t)(counter << 8 | lfu_minutes());
+  }
+}
+
+// the keyspace of this shard: the objects of the slab allocator, and
+// the hash tables of the keys and of the large zsets.
+uint64_t used_memory() {
+  return slab_used_bytes() + sm_thread_mem();
+}
+
+static uint64_t shard_limit() {
+  return g_config.maxmemory / shard_count();
+}
+
+static bool evict_over(uint64_t limit) {
+  return limit != 0 && g_config.evict_policy != EVICT_NONE
+    && used_memory() > limit;
+}
+
+static bool entry_volatile(Entry *ent) {
+  return (ent->flags & ENT_TTL) && tw_armed(entry_timer(ent));
+}
+
+// higher is a better victim
+static uint64_t evict_score(Entry *ent) {
+  switch (g_config.evict_policy) {
+  case EVICT_ALLKEYS_LRU:
+    return (uint16_t)(lru_clock() - ent->access);
+  case EVICT_ALLKEYS_LFU:
+    return 255 - lfu_counter(ent);
+  default:
+    return ~entry_timer(ent)->expire;
+  }
+}
+
+// add a sample of keys to the pool. a full pool only takes keys better
+// than its worst.
+static void pool_fill() {
+  std::vector<EvictCand> &pool = t_pool;
+  SNode *nodes[k_evict_samples];
+  size_t got = sm_sample(&g_data.db, evict_rand(), nodes, k_evict_samples);
+  for (size_t i = 0; i < got; ++i) {
+    Entry *ent = container_of(nodes[i], Entry, node);
+    if (g_config.evict_policy == EVICT_VOLATILE_TTL && !entry_volatile(ent)) {
+      continue;
+    }
+    uint64_t score = evict_score(ent);
+    if (pool.size() == k_evict_pool && score <= pool[0].score) {
+      continue;
+    }
+    bool dup = false;
+    for (size_t j = 0; j < pool.size() && !dup; ++j) {
+      dup = pool[j].key.size() == ent->klen
+        && 0 == memcmp(pool[j].key.data(), entry_key(ent), ent->klen);
+    }
+    if (dup) {
+      continue;
+    }
+    if (pool.size() == k_evict_pool) {
+      pool.erase(pool.begin()); // drop the worst
+    }
+    size_t j = pool.size();
+    pool.emplace_back();
+    for (; j > 0 && pool[j - 1].score > score; --j) {
+      pool[j] = std::move(pool[j - 1]);
+    }
+    pool[j].score = score;
+    pool[j].key.assign(entry_key(ent), ent->klen);
+  }
+}
+
+// the best candidate that is still there and hasn't been used since,
+// or NULL if the pool runs out.
+static Entry *pool_pop() {
+  std::vector<EvictCand> &pool = t_pool;
+  while (!pool.empty()) {
+    EvictCand &cand = pool.back();
+    Entry *ent = db_peek(cand.key.data(), cand.key.size());
+    bool ok = ent && evict_score(ent) >= cand.score
+      && (g_config.evict_policy != EVICT_VOLATILE_TTL || entry_volatile(ent));
+    pool.pop_back();
+    if (ok) {
+      return ent;
+    }
+  }
+  return NULL;
+}
+
+static bool node_same(SNode *node, SNode *key) {
+  return node == key;
+}
+
+// the value is freed right away, not in the background, so the memory
+// is down before the next victim is picked.
+static void evict_entry(Entry *ent) {
+  sm_pop(&g_data.db, &ent->node, &node_same);
+  if (aof_enabled()) {
+    std::string_view args[2] = {"del", {entry_key(ent), ent->klen}};
+    aof_log(args, 2);
+  }
+  entry_del(ent);
+  g_data.stats.evicted_keys++;
+  g_data.rdb.dirty++;
+}
+
+// evict until the shard is under `limit` or the time is up.
+// false if nothing can be evicted.
+static bool evict_pass(uint64_t limit) {
+  uint64_t deadline = get_monotonic_usec() + k_evict_budget_us;
+  t_evict_more = false;
+  for (uint32_t i = 1; used_memory() > limit; ++i) {
+    Entry *victim = NULL;
+    for (uint32_t tries = 1; tries <= k_evict_tries && !victim; ++tries) {
+      pool_fill();
+      // a key used within the current tick is the last resort
+      bool fresh = t_pool.empty() || t_pool.back().score == 0;
+      if (!fresh || tries == k_evict_tries) {
+        victim = pool_pop();
+      }
+    }
+    if (!victim) {
+      return false;
+    }
+    evict_entry(victim);
+    if (i % k_evict_batch == 0 && get_monotonic_usec() >= deadline) {
+      t_evict_more = used_memory() > limit;
+      break;
+    }
+  }
+  return true;
+}
+
+// before a write that may add data. over the limit, a few keys are
+// evicted, and the write fails only if there is nothing to evict.
+// the rest is evicted by the event loop, see evict_cron().
+bool evict_admit(std::string &out) {
+  uint64_t limit = shard_limit();
+  if (limit == 0 || used_memory() <= limit) {
+    return true;
+  }
+  if (g_config.evict_policy != EVICT_NONE && evict_pass(limit)) {
+    return true;
+  }
+  out_err(out, ERR_OOM, "command not allowed when used memory > maxmemory");
+  return false;
+}
+
+// the loop should come back without waiting for events
+bool evict_pending() {
+  return t_evict_more;
+}
+
+void evict_cron() {
+  uint64_t limit = shard_limit();
+  if (evict_over(limit)) {
+    evict_pass(limit);
+  } else {
+    t_evict_more = false;
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "server_data.h"
+
+// maxmemory and eviction. every shard keeps its keyspace under its share
+// of g_config.maxmemory. the victims are picked by sampling keys from the
+// hash table and comparing a small access clock kept in every entry,
+// instead of keeping the keys in a global lru list.
+void entry_touch(Entry *ent, bool created);
+uint64_t used_memory();
+bool evict_admit(std::string &out);
+bool evict_pending();
+void evict_cron();
@@ -39,11 +39,61 @@ void out_err(std::string &out, int32_t code, const std::string &msg) {
   out.append(msg);
 }
 
+// the message of a reply written by out_err(), false for other replies
+bool out_err_msg(const std::string &out, std::string &msg) {
+  if (out.size() < 9 || out[0] != SER_ERR) {
+    return false;
+  }
+  uint32_t len = 0;
+  memcpy(&len, &out[5], 4);
+  msg.assign(out, 9, len);
+  return true;
+}
+
 void out_arr(std::string &out, uint32_t n) {
   out.push_back(SER_ARR);
   out.append((char *)&n, 4);
 }
 
+// append the elements of a serialized array to the array in `out`.
+void arr_merge(std::string &out, const std::string &arr) {
+  assert(out.size() >= 5 && out[0] == SER_ARR);
+  assert(arr.size() >= 5 && arr[0] == SER_ARR);
+  uint32_t n = 0;
+  uint32_t m = 0;
+  memcpy(&n, &out[1], 4);
+  memcpy(&m, &arr[1], 4);
+  n += m;
+  memcpy(&out[1], &n, 4);
+  out.append(arr, 5, std::string::npos);
+}
+
+// the end of the serialized value at `pos`
+size_t ser_end(const std::string &out, size_t pos) {
+  uint32_t len = 0;
+  switch (out[pos]) {
+    case SER_NIL:
+      return pos + 1;
+    case SER_ERR:
+      memcpy(&len, &out[pos + 5], 4);
+      return pos + 9 + len;
+    case SER_STR:
+      memcpy(&len, &out[pos + 1], 4);
+      return pos + 5 + len;
+    case SER_INT:
+    case SER_DBL:
+      return pos + 9;
+    default:
+      assert(out[pos] == SER_ARR);
+      memcpy(&len, &out[pos + 1], 4);
+      pos += 5;
+      while (len--) {
+        pos = ser_end(out, pos);
+      }
+      return pos;
+  }
+}
+
 void *begin_arr(std::string &out) {
   out.push_back(SER_ARR);
   out.append("\0\0\0\0", 4); // filled in end_arr()
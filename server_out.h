@@ -9,4 +9,7 @@ void out_str(std::string &out, const std::string &val);
 void out_int(std::string &out, int64_t val);
 void out_dbl(std::string &out, double val);
 void out_err(std::string &out, int32_t code, const std::string &msg);
-void out_arr(std::string &out, uint32_t n);
\ No newline at end of file
+bool out_err_msg(const std::string &out, std::string &msg);
+void out_arr(std::string &out, uint32_t n);
+void arr_merge(std::string &out, const std::string &arr);
+size_t ser_end(const std::string &out, size_t pos);
\ No newline at end of file
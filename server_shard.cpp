@@ -0,0 +1,100 @@
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "server_shard.h"
+
+static std::vector<Shard *> g_shards;
+static std::atomic<uint32_t> g_barrier_count{0};
+static std::atomic<uint32_t> g_barrier_gen{0};
+
+// must be called before any reactor thread is started.
+void shards_init(uint32_t n) {
+  assert(n > 0 && g_shards.empty());
+  for (uint32_t i = 0; i < n; ++i) {
+    Shard *shard = new Shard();
+    shard->id = i;
+    shard->evfd = eventfd(0, EFD_NONBLOCK);
+    if (shard->evfd < 0) {
+      die("eventfd");
+    }
+    g_shards.push_back(shard);
+  }
+}
+
+uint32_t shard_count() {
+  return g_shards.empty() ? 1 : (uint32_t)g_shards.size();
+}
+
+Shard *shard_get(uint32_t id) {
+  return g_shards[id];
+}
+
+// the shard that owns a key.
+// a fixed seed, since the files of the AOF and the snapshots are per shard.
+uint32_t shard_of(std::string_view key) {
+  uint64_t h = hash_bytes((uint8_t *)key.data(), key.size(), 0);
+  return (uint32_t)((h >> 32) % shard_count());
+}
+
+void shard_send(uint32_t id, ShardMsg *msg) {
+  Shard *shard = g_shards[id];
+  // push onto the stack
+  ShardMsg *head = shard->mailbox.load(std::memory_order_relaxed);
+  do {
+    msg->next = head;
+  } while (!shard->mailbox.compare_exchange_weak(
+    head, msg, std::memory_order_release, std::memory_order_relaxed));
+  // only the first message into an empty mailbox needs a wakeup,
+  // the reactor drains everything it finds.
+  if (!head) {
+    uint64_t one = 1;
+    ssize_t rv = write(shard->evfd, &one, sizeof(one));
+    (void)rv;
+  }
+}
+
+// take every pending message, oldest first.
+ShardMsg *shard_recv(Shard *shard) {
+  // clear the wakeup before taking the messages, so a message pushed
+  // after the exchange always causes a new wakeup.
+  uint64_t cnt = 0;
+  ssize_t rv = read(shard->evfd, &cnt, sizeof(cnt));
+  (void)rv;
+  ShardMsg *list = shard->mailbox.exchange(NULL, std::memory_order_acquire);
+  // the stack is LIFO, reverse it
+  ShardMsg *fifo = NULL;
+  while (list) {
+    ShardMsg *next = list->next;
+    list->next = fifo;
+    fifo = list;
+    list = next;
+  }
+  return fifo;
+}
+
+// wait until every reactor got here. only used during startup.
+void shards_barrier() {
+  uint32_t n = shard_count();
+  if (n == 1) {
+    return;
+  }
+  uint32_t gen = g_barrier_gen.load();
+  if (g_barrier_count.fetch_add(1) + 1 == n) {
+    g_barrier_count.store(0);
+    g_barrier_gen.fetch_add(1);
+    return;
+  }
+  while (g_barrier_gen.load() == gen) {
+    std::this_thread::yield();
+  }
+}
+
+// the file of a shard, shard 0 uses the base path so that a single
+// reactor uses the file name as configured.
+std::string shard_path(const std::string &base, uint32_t id) {
+  return id == 0 ? base : base + "." + std::to_string(id);
+}
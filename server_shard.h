@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum {
+  MSG_REQ = 0, // run a command on the owning shard
+  MSG_RES = 1, // the response, sent back to the shard of the connection
+};
+
+// a forwarded command. it travels to the owning shard and comes back
+// with the serialized response.
+struct ShardMsg {
+  ShardMsg *next = NULL;
+  uint32_t type = MSG_REQ;
+  uint32_t from = 0; // shard that owns the connection
+  int fd = -1; // the connection on the `from` shard
+  uint64_t conn_id = 0; // detects a closed and reused fd
+  // shards still to visit for commands that span every shard
+  uint32_t fanout = 0;
+  std::vector<std::string> cmd;
+  std::string out;
+};
+
+// one reactor thread. everything except the mailbox is owned by that thread.
+struct Shard {
+  uint32_t id = 0;
+  int evfd = -1; // eventfd that wakes up the reactor
+  std::atomic<ShardMsg *> mailbox{NULL}; // lock-free MPSC stack
+};
+
+void shards_init(uint32_t n);
+uint32_t shard_count();
+Shard *shard_get(uint32_t id);
+uint32_t shard_of(std::string_view key);
+void shard_send(uint32_t id, ShardMsg *msg);
+ShardMsg *shard_recv(Shard *shard);
+void shards_barrier();
+std::string shard_path(const std::string &base, uint32_t id);
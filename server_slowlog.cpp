@@ -0,0 +1,156 @@
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "server_slowlog.h"
+#include "server_common.h"
+#include "server_data.h"
+#include "server_out.h"
+#include "server_shard.h"
+
+// a logged command keeps this many args of up to this many bytes
+const size_t k_slowlog_max_args = 32;
+const size_t k_slowlog_max_arg_len = 128;
+
+// ids are shared by the shards, so a merged log is ordered by them
+static std::atomic<uint64_t> g_slowlog_id{0};
+
+void slowlog_push(const Cmd &cmd, int fd, uint64_t duration_us) {
+  SlowLog &log = g_data.slowlog;
+  size_t cap = g_config.slowlog_max_len;
+  if (cap == 0) {
+    return;
+  }
+  if (log.ring.size() < cap) {
+    log.ring.emplace_back();
+    log.next = log.ring.size() - 1;
+  }
+  SlowEntry &ent = log.ring[log.next];
+  log.next = (log.next + 1) % cap;
+
+  ent.id = g_slowlog_id.fetch_add(1, std::memory_order_relaxed);
+  ent.unix_s = get_wall_msec() / 1000;
+  ent.duration_us = duration_us;
+  ent.fd = fd;
+  ent.args.clear();
+  size_t n = cmd.size() > k_slowlog_max_args ? k_slowlog_max_args - 1 : cmd.size();
+  for (size_t i = 0; i < n; ++i) {
+    std::string_view arg = cmd[i];
+    if (arg.size() <= k_slowlog_max_arg_len) {
+      ent.args.emplace_back(arg);
+    } else {
+      ent.args.emplace_back(arg.substr(0, k_slowlog_max_arg_len));
+      ent.args.back() += "... ("
+        + std::to_string(arg.size() - k_slowlog_max_arg_len) + " more bytes)";
+    }
+  }
+  if (n < cmd.size()) {
+    ent.args.push_back("... (" + std::to_string(cmd.size() - n) + " more arguments)");
+  }
+}
+
+// the i-th newest entry
+static SlowEntry &slowlog_at(SlowLog &log, size_t i) {
+  size_t n = log.ring.size();
+  return log.ring[(log.next + n - 1 - i) % n];
+}
+
+// the `count` arg of get, 10 by default
+static bool slowlog_count(Cmd &cmd, int64_t &count) {
+  count = 10;
+  return cmd.size() < 3 || (str2int(cmd[2], count) && count >= 0);
+}
+
+// slowlog get [count], slowlog len, slowlog reset
+// like bgsave, every shard answers with an array, the arrays are merged,
+// then slowlog_merge() makes the reply out of them.
+// get returns [id, unix time, duration in us, client fd, [args...]]
+// for the newest `count` (10) entries.
+void do_slowlog(Cmd &cmd, std::string &out) {
+  SlowLog &log = g_data.slowlog;
+  std::string_view sub = cmd[1];
+  if (cmd_is(sub, "get") && cmd.size() <= 3) {
+    int64_t count = 0;
+    if (!slowlog_count(cmd, count)) {
+      return out_err(out, ERR_ARG, "expect non-negative int");
+    }
+    size_t n = log.ring.size() < (uint64_t)count ? log.ring.size() : (size_t)count;
+    out_arr(out, (uint32_t)n);
+    for (size_t i = 0; i < n; ++i) {
+      SlowEntry &ent = slowlog_at(log, i);
+      out_arr(out, 5);
+      out_int(out, (int64_t)ent.id);
+      out_int(out, (int64_t)ent.unix_s);
+      out_int(out, (int64_t)ent.duration_us);
+      out_int(out, ent.fd);
+      out_arr(out, (uint32_t)ent.args.size());
+      for (const std::string &arg : ent.args) {
+        out_str(out, arg);
+      }
+    }
+  } else if (cmd_is(sub, "len") && cmd.size() == 2) {
+    out_arr(out, 1);
+    out_int(out, (int64_t)log.ring.size());
+  } else if (cmd_is(sub, "reset") && cmd.size() == 2) {
+    log.ring.clear();
+    log.next = 0;
+    out_arr(out, 0);
+  } else {
+    return out_err(out, ERR_ARG, "expect get, len or reset");
+  }
+  if (shard_count() == 1) {
+    slowlog_merge(cmd, out);
+  }
+}
+
+// the reply out of the arrays of all shards: the newest `count`
+// entries by id, the sum of the lengths, or nil for reset.
+void slowlog_merge(Cmd &cmd, std::string &out) {
+  uint32_t n = 0;
+  memcpy(&n, &out[1], 4);
+  std::string_view sub = cmd[1];
+  if (cmd_is(sub, "len")) {
+    int64_t total = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      int64_t len = 0;
+      memcpy(&len, &out[5 + 9 * i + 1], 8);
+      total += len;
+    }
+    out.clear();
+    return out_int(out, total);
+  }
+  if (cmd_is(sub, "reset")) {
+    out.clear();
+    return out_nil(out);
+  }
+
+  // each entry is [SER_ARR][5][SER_INT][id]...
+  struct Span {
+    int64_t id;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Span> spans;
+  size_t pos = 5;
+  for (uint32_t i = 0; i < n; ++i) {
+    Span span = {0, pos, ser_end(out, pos)};
+    memcpy(&span.id, &out[pos + 6], 8);
+    spans.push_back(span);
+    pos = span.end;
+  }
+  std::sort(spans.begin(), spans.end(), [](const Span &a, const Span &b) {
+    return a.id > b.id;
+  });
+  int64_t count = 0;
+  slowlog_count(cmd, count);
+  if ((uint64_t)count < spans.size()) {
+    spans.resize((size_t)count);
+  }
+  std::string merged;
+  out_arr(merged, (uint32_t)spans.size());
+  for (const Span &span : spans) {
+    merged.append(out, span.begin, span.end - span.begin);
+  }
+  out.swap(merged);
+}
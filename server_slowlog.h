@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "server_cmd.h"
+
+// a command that ran longer than g_config.slowlog_slower_than_us
+struct SlowEntry {
+  uint64_t id = 0;
+  uint64_t unix_s = 0; // when it was recorded
+  uint64_t duration_us = 0;
+  int fd = -1; // the client, on the shard that owns the connection
+  std::vector<std::string> args; // truncated
+};
+
+// the slow commands of a shard, the oldest one is overwritten when full.
+struct SlowLog {
+  std::vector<SlowEntry> ring;
+  size_t next = 0; // the slot of the next entry
+};
+
+void slowlog_push(const Cmd &cmd, int fd, uint64_t duration_us);
+void do_slowlog(Cmd &cmd, std::string &out);
+void slowlog_merge(Cmd &cmd, std::string &out);
@@ -0,0 +1,180 @@
+#include <math.h>
+#include <string>
+#include <vector>
+#include "server_stats.h"
+#include "server_common.h"
+#include "server_evict.h"
+#include "server_out.h"
+#include "server_shard.h"
+#include "slab.h"
+
+// indexed by the CMD_ enum
+static const char *const k_cmd_names[CMD_COUNT] = {
+  "get", "set", "mget", "mset", "del", "mdel", "unlink",
+  "keys", "scan", "zadd", "zrem", "zscore", "zquery", "zscan",
+  "zcard", "zrank", "zrevrank", "zrange", "zcount", "ttl",
+  "pexpireat", "bgrewriteaof", "save", "bgsave", "info",
+  "slowlog",
+  "other",
+};
+
+uint32_t cmd_id(std::string_view name) {
+  for (uint32_t i = 0; i < CMD_OTHER; ++i) {
+    const char *s = k_cmd_names[i];
+    if (!name.empty() && s[0] == (name[0] | 0x20) && cmd_is(name, s)) {
+      return i;
+    }
+  }
+  return CMD_OTHER;
+}
+
+// the largest value of a bucket
+static uint64_t bucket_max(uint32_t i) {
+  if (i < (1u << k_hist_sub_bits)) {
+    return i;
+  }
+  uint32_t e = (i >> k_hist_sub_bits) + k_hist_sub_bits - 1;
+  uint64_t sub = i & ((1u << k_hist_sub_bits) - 1);
+  uint32_t shift = e - k_hist_sub_bits;
+  return ((((uint64_t)1 << k_hist_sub_bits) + sub + 1) << shift) - 1;
+}
+
+// the value below which a fraction q of the values are, rounded up to
+// the end of its bucket.
+uint64_t hist_quantile(const Hist *h, double q) {
+  if (h->count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)ceil(q * (double)h->count);
+  rank = rank < 1 ? 1 : rank;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < k_hist_buckets; ++i) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t v = bucket_max(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+static void info_int(std::string &s, const char *key, uint64_t val) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%s:%llu\r\n", key, (unsigned long long)val);
+  s += buf;
+}
+
+static void info_str(std::string &s, const char *key, const char *val) {
+  s += key;
+  s += ':';
+  s += val;
+  s += "\r\n";
+}
+
+// count, then quantiles in us
+static void info_hist(std::string &s, const char *key, const Hist *h) {
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+    "%s:calls=%llu,avg_us=%.2f,p50_us=%.2f,p99_us=%.2f,p999_us=%.2f,max_us=%.2f\r\n",
+    key, (unsigned long long)h->count,
+    h->count ? (double)h->sum / (double)h->count / 1e3 : 0.0,
+    (double)hist_quantile(h, 0.5) / 1e3, (double)hist_quantile(h, 0.99) / 1e3,
+    (double)hist_quantile(h, 0.999) / 1e3, (double)h->max / 1e3);
+  s += buf;
+}
+
+static const char *k_io_names[] = {"epoll", "poll", "uring"};
+static const char *k_policy_names[] = {
+  "noeviction", "allkeys-lru", "allkeys-lfu", "volatile-ttl",
+};
+
+static void info_server(std::string &s) {
+  info_int(s, "shard", g_data.shard_id);
+  info_int(s, "shards", shard_count());
+  info_str(s, "io", k_io_names[g_config.io]);
+  info_int(s, "uptime_s", (get_monotonic_msec() - g_data.stats.start_ms) / 1000);
+}
+
+static void info_clients(std::string &s) {
+  Stats &st = g_data.stats;
+  info_int(s, "connected_clients", st.conns);
+  info_int(s, "total_connections", st.conns_total);
+}
+
+static void info_memory(std::string &s) {
+  info_int(s, "used_memory", used_memory());
+  info_int(s, "maxmemory", g_config.maxmemory / shard_count());
+  info_str(s, "maxmemory_policy", k_policy_names[g_config.evict_policy]);
+  info_int(s, "slab_pages", slab_pages());
+  std::vector<SlabStat> classes;
+  slab_stats(classes);
+  for (SlabStat &cls : classes) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "slab_%zu:used=%llu,total=%llu\r\n", cls.size,
+      (unsigned long long)cls.used, (unsigned long long)cls.total);
+    s += buf;
+  }
+}
+
+static void info_stats(std::string &s) {
+  Stats &st = g_data.stats;
+  uint64_t calls = 0;
+  for (Hist &h : st.cmds) {
+    calls += h.count;
+  }
+  info_int(s, "total_commands", calls);
+  info_int(s, "bytes_in", st.bytes_in);
+  info_int(s, "bytes_out", st.bytes_out);
+  info_int(s, "expired_keys", st.expired_keys);
+  info_int(s, "evicted_keys", st.evicted_keys);
+  info_hist(s, "event_loop", &st.loop);
+}
+
+static void info_keyspace(std::string &s) {
+  SwissMap &db = g_data.db;
+  info_int(s, "keys", sm_size(&db));
+  info_int(s, "keys_with_ttl", g_data.ttl_wheel.size);
+  info_int(s, "table_slots", st_cap(&db.newer));
+  // non-zero while the keys are moved to a resized table
+  info_int(s, "old_table_slots", st_cap(&db.older));
+  info_int(s, "old_table_keys", db.older.size);
+}
+
+static void info_commandstats(std::string &s) {
+  for (uint32_t i = 0; i < CMD_COUNT; ++i) {
+    if (g_data.stats.cmds[i].count) {
+      std::string key = std::string("cmd_") + k_cmd_names[i];
+      info_hist(s, key.c_str(), &g_data.stats.cmds[i]);
+    }
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*f)(std::string &);
+} k_sections[] = {
+  {"Server", &info_server},
+  {"Clients", &info_clients},
+  {"Memory", &info_memory},
+  {"Stats", &info_stats},
+  {"Keyspace", &info_keyspace},
+  {"Commandstats", &info_commandstats},
+};
+
+// info [section]
+// a text of "key:value" lines per shard, in an array so the shards can
+// be merged.
+void do_info(Cmd &cmd, std::string &out) {
+  std::string_view want = cmd.size() > 1 ? cmd[1] : "all";
+  std::string s;
+  for (auto &sec : k_sections) {
+    if (cmd_is(want, "all") || cmd_is(want, sec.name)) {
+      s += s.empty() ? "# " : "\r\n# ";
+      s += sec.name;
+      s += "\r\n";
+      sec.f(s);
+    }
+  }
+  out_arr(out, 1);
+  out_str(out, s);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "server_cmd.h"
+
+// a log-linear histogram of ns: 4 buckets per power of 2, so a quantile
+// is off by at most 25%. adding a value is a clz and an increment.
+// values from about 18 minutes up share the last bucket.
+const uint32_t k_hist_sub_bits = 2;
+const uint32_t k_hist_max_bits = 40;
+const uint32_t k_hist_buckets = (k_hist_max_bits - k_hist_sub_bits + 1) << k_hist_sub_bits;
+
+struct Hist {
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+  uint64_t buckets[k_hist_buckets] = {};
+};
+
+inline uint32_t hist_bucket(uint64_t v) {
+  if (v >> k_hist_max_bits) {
+    v = ((uint64_t)1 << k_hist_max_bits) - 1;
+  }
+  if (v < (1u << k_hist_sub_bits)) {
+    return (uint32_t)v;
+  }
+  uint32_t e = 63 - (uint32_t)__builtin_clzll(v);
+  uint32_t sub = (uint32_t)(v >> (e - k_hist_sub_bits)) & ((1u << k_hist_sub_bits) - 1);
+  return ((e - k_hist_sub_bits + 1) << k_hist_sub_bits) | sub;
+}
+
+inline void hist_add(Hist *h, uint64_t v) {
+  h->count++;
+  h->sum += v;
+  h->max = v > h->max ? v : h->max;
+  h->buckets[hist_bucket(v)]++;
+}
+
+uint64_t hist_quantile(const Hist *h, double q);
+
+// the commands with their own counters, the rest are "other"
+enum {
+  CMD_GET, CMD_SET, CMD_MGET, CMD_MSET, CMD_DEL, CMD_MDEL, CMD_UNLINK,
+  CMD_KEYS, CMD_SCAN, CMD_ZADD, CMD_ZREM, CMD_ZSCORE, CMD_ZQUERY, CMD_ZSCAN,
+  CMD_ZCARD, CMD_ZRANK, CMD_ZREVRANK, CMD_ZRANGE, CMD_ZCOUNT, CMD_TTL,
+  CMD_PEXPIREAT, CMD_BGREWRITEAOF, CMD_SAVE, CMD_BGSAVE, CMD_INFO,
+  CMD_SLOWLOG,
+  CMD_OTHER,
+  CMD_COUNT,
+};
+
+// the counters of a shard, see GData.
+struct Stats {
+  uint64_t start_ms = 0;
+  // latency of the client requests by command, from parsed to responded
+  Hist cmds[CMD_COUNT];
+  // time spent in an event loop iteration, without the wait for events
+  Hist loop;
+  uint64_t conns = 0; // open connections
+  uint64_t conns_total = 0; // accepted since the start
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  uint64_t expired_keys = 0;
+  uint64_t evicted_keys = 0;
+};
+
+uint32_t cmd_id(std::string_view name);
+void do_info(Cmd &cmd, std::string &out);
@@ -0,0 +1,194 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <atomic>
+#include "common.h"
+#include "slab.h"
+
+const size_t k_slab_page = 64 * 1024;
+const size_t k_slab_align = 16;
+const size_t k_slab_classes = k_slab_max / k_slab_align;
+// pages are mapped in chunks, larger ones while bulk loading
+const size_t k_chunk_pages = 16;
+const size_t k_bulk_pages = 256;
+
+struct SlabClass;
+
+// at the start of every page, found by masking an object address
+struct SlabPage {
+  SlabClass *cls;
+  uint64_t pad;
+};
+
+struct SlabClass {
+  size_t size = 0;
+  void *free_list = NULL; // linked through the first word of the object
+  // objects freed by other threads, a lock-free stack
+  std::atomic<void *> remote{NULL};
+  std::atomic<uint64_t> remote_freed{0};
+  // the unused part of the newest page
+  char *bump = NULL;
+  char *bump_end = NULL;
+  uint64_t used = 0; // minus remote_freed
+  uint64_t total = 0;
+};
+
+struct SlabSet {
+  SlabClass classes[k_slab_classes];
+  uint64_t pages = 0;
+  // bulk mode
+  bool bulk = false;
+  char *chunk = NULL;
+  size_t chunk_pages = 0;
+  // objects above k_slab_max, possibly freed by other threads
+  std::atomic<uint64_t> large_bytes{0};
+};
+
+// in front of an object above k_slab_max, so it is accounted to the
+// owner whichever thread frees it. keeps the 16-byte alignment of malloc.
+struct SlabLarge {
+  std::atomic<uint64_t> *bytes;
+  uint64_t pad;
+};
+
+static thread_local SlabSet t_slabs;
+
+static bool is_local(SlabClass *cls) {
+  return cls >= t_slabs.classes && cls < t_slabs.classes + k_slab_classes;
+}
+
+// a run of aligned pages straight from mmap, without any malloc overhead
+static char *chunk_new(size_t npages) {
+  size_t len = npages * k_slab_page;
+  char *ptr = (char *)mmap(NULL, len + k_slab_page, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    die("out of memory");
+  }
+  // trim to a page boundary
+  char *chunk = (char *)(((uintptr_t)ptr + k_slab_page - 1) & ~(uintptr_t)(k_slab_page - 1));
+  if (chunk > ptr) {
+    munmap(ptr, (size_t)(chunk - ptr));
+  }
+  if (chunk + len < ptr + len + k_slab_page) {
+    munmap(chunk + len, (size_t)(ptr + len + k_slab_page - (chunk + len)));
+  }
+  return chunk;
+}
+
+static char *page_new() {
+  SlabSet &set = t_slabs;
+  if (set.chunk_pages == 0) {
+    set.chunk_pages = set.bulk ? k_bulk_pages : k_chunk_pages;
+    set.chunk = chunk_new(set.chunk_pages);
+  }
+  char *page = set.chunk;
+  set.chunk += k_slab_page;
+  set.chunk_pages--;
+  set.pages++;
+  return page;
+}
+
+static void *class_alloc(SlabClass *cls) {
+  if (!cls->free_list && cls->remote.load(std::memory_order_relaxed)) {
+    // take back what other threads freed
+    cls->free_list = cls->remote.exchange(NULL, std::memory_order_acquire);
+  }
+  if (void *obj = cls->free_list) {
+    cls->free_list = *(void **)obj;
+    cls->used++;
+    return obj;
+  }
+  if (cls->bump + cls->size > cls->bump_end) {
+    char *page = page_new();
+    ((SlabPage *)page)->cls = cls;
+    cls->bump = page + sizeof(SlabPage);
+    cls->bump_end = page + k_slab_page;
+    cls->total += (k_slab_page - sizeof(SlabPage)) / cls->size;
+  }
+  void *obj = cls->bump;
+  cls->bump += cls->size;
+  cls->used++;
+  return obj;
+}
+
+void *slab_alloc(size_t size) {
+  if (size == 0) {
+    return malloc(0);
+  }
+  if (size > k_slab_max) {
+    SlabLarge *hdr = (SlabLarge *)malloc(sizeof(SlabLarge) + size);
+    if (!hdr) {
+      die("out of memory");
+    }
+    hdr->bytes = &t_slabs.large_bytes;
+    hdr->bytes->fetch_add(size, std::memory_order_relaxed);
+    return hdr + 1;
+  }
+  size_t idx = (size + k_slab_align - 1) / k_slab_align - 1;
+  SlabClass *cls = &t_slabs.classes[idx];
+  cls->size = (idx + 1) * k_slab_align;
+  return class_alloc(cls);
+}
+
+void slab_free(void *ptr, size_t size) {
+  if (!ptr || size == 0) {
+    return free(ptr);
+  }
+  if (size > k_slab_max) {
+    SlabLarge *hdr = (SlabLarge *)ptr - 1;
+    hdr->bytes->fetch_sub(size, std::memory_order_relaxed);
+    return free(hdr);
+  }
+  SlabPage *page = (SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(k_slab_page - 1));
+  SlabClass *cls = page->cls;
+  assert(cls->size >= size && cls->size < size + k_slab_align);
+  if (is_local(cls)) {
+    *(void **)ptr = cls->free_list;
+    cls->free_list = ptr;
+    cls->used--;
+    return;
+  }
+  // e.g. a lazy free on the bio thread
+  void *head = cls->remote.load(std::memory_order_relaxed);
+  do {
+    *(void **)ptr = head;
+  } while (!cls->remote.compare_exchange_weak(
+    head, ptr, std::memory_order_release, std::memory_order_relaxed));
+  cls->remote_freed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void slab_bulk_begin() {
+  t_slabs.bulk = true;
+}
+
+void slab_bulk_end() {
+  t_slabs.bulk = false;
+}
+
+void slab_stats(std::vector<SlabStat> &out) {
+  for (SlabClass &cls : t_slabs.classes) {
+    if (cls.total == 0) {
+      continue;
+    }
+    SlabStat stat;
+    stat.size = cls.size;
+    stat.used = cls.used - cls.remote_freed.load(std::memory_order_relaxed);
+    stat.total = cls.total;
+    out.push_back(stat);
+  }
+}
+
+uint64_t slab_pages() {
+  return t_slabs.pages;
+}
+
+// bytes of the live objects of the calling thread, by class size
+uint64_t slab_used_bytes() {
+  uint64_t bytes = t_slabs.large_bytes.load(std::memory_order_relaxed);
+  for (SlabClass &cls : t_slabs.classes) {
+    bytes += (cls.used - cls.remote_freed.load(std::memory_order_relaxed)) * cls.size;
+  }
+  return bytes;
+}
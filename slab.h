@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// size-class allocator for the small objects of the keyspace.
+// objects are carved out of 64 KB pages owned by the allocating thread,
+// so they pack without per-allocation malloc headers. an object may be
+// freed by any thread, it goes back to the owner's free list.
+// sizes above k_slab_max go to malloc. the size passed to slab_free()
+// must be the one passed to slab_alloc().
+const size_t k_slab_max = 1024;
+
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+
+// while loading a snapshot or the AOF, pages come from large chunks,
+// and objects allocated one after another end up next to each other.
+void slab_bulk_begin();
+void slab_bulk_end();
+
+struct SlabStat {
+  size_t size = 0; // object size of the class
+  uint64_t used = 0; // live objects
+  uint64_t total = 0; // objects that fit in the pages of the class
+};
+
+// counters of the calling thread
+void slab_stats(std::vector<SlabStat> &out);
+uint64_t slab_pages();
+uint64_t slab_used_bytes();
@@ -0,0 +1,370 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "common.h"
+#include "swisstable.h"
+
+// slots are probed a group at a time
+const size_t k_group = 16;
+
+enum : int8_t {
+  CTRL_EMPTY = -128, // 0x80
+  CTRL_DELETED = -2, // 0xfe, a tombstone that keeps probe chains intact
+  // anything else is a full slot with the low 7 bits of the hash
+};
+
+// bytes of the live tables allocated by a thread, see sm_thread_mem()
+static thread_local std::atomic<uint64_t> t_tab_bytes{0};
+
+// in front of the control bytes, so a table is accounted to the thread
+// that allocated it whichever thread frees it. keeps the group alignment.
+struct TabHeader {
+  std::atomic<uint64_t> *bytes;
+  uint64_t pad;
+};
+static_assert(sizeof(TabHeader) == k_group, "");
+
+// the group to start probing from, and the tag stored in the control byte
+static size_t hash_h1(uint64_t hcode) {
+  return (size_t)(hcode >> 7);
+}
+
+static int8_t hash_h2(uint64_t hcode) {
+  return (int8_t)(hcode & 0x7f);
+}
+
+// a bit per slot of the group whose tag equals `tag`
+static uint32_t group_match(const int8_t *ctrl, int8_t tag) {
+#ifdef __SSE2__
+  __m128i group = _mm_load_si128((const __m128i *)ctrl);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+  uint32_t bits = 0;
+  for (size_t i = 0; i < k_group; ++i) {
+    bits |= (uint32_t)(ctrl[i] == tag) << i;
+  }
+  return bits;
+#endif
+}
+
+// empty and deleted slots are the ones with the high bit set
+static uint32_t group_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+  return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+#else
+  uint32_t bits = 0;
+  for (size_t i = 0; i < k_group; ++i) {
+    bits |= (uint32_t)(ctrl[i] < 0) << i;
+  }
+  return bits;
+#endif
+}
+
+size_t st_cap(SwissTab *tab) {
+  return tab->ctrl ? (tab->mask + 1) * k_group : 0;
+}
+
+static uint64_t st_bytes(size_t cap) {
+  return cap * (1 + sizeof(SNode *));
+}
+
+// n must be a power of 2
+static void st_init(SwissTab *tab, size_t ngroups) {
+  assert(ngroups > 0 && ((ngroups - 1) & ngroups) == 0);
+  size_t cap = ngroups * k_group;
+  TabHeader *hdr = (TabHeader *)aligned_alloc(k_group, sizeof(TabHeader) + cap);
+  tab->slots = (SNode **)malloc(cap * sizeof(SNode *));
+  if (!hdr || !tab->slots) {
+    die("out of memory");
+  }
+  hdr->bytes = &t_tab_bytes;
+  hdr->bytes->fetch_add(st_bytes(cap), std::memory_order_relaxed);
+  tab->ctrl = (int8_t *)(hdr + 1);
+  memset(tab->ctrl, CTRL_EMPTY, cap);
+  tab->mask = ngroups - 1;
+  tab->size = 0;
+  tab->used = 0;
+}
+
+static void st_free(SwissTab *tab) {
+  if (tab->ctrl) {
+    TabHeader *hdr = (TabHeader *)tab->ctrl - 1;
+    hdr->bytes->fetch_sub(st_bytes(st_cap(tab)), std::memory_order_relaxed);
+    free(hdr);
+  }
+  free(tab->slots);
+  *tab = SwissTab{};
+}
+
+// returns the slot index of the node, or -1.
+// groups are probed in triangular steps, which visits every group of a
+// power-of-2 table. the probe ends at the first group with an empty slot.
+static size_t st_find(SwissTab *tab, SNode *key, bool (*eq)(SNode *, SNode *)) {
+  if (!tab->ctrl) {
+    return (size_t)-1;
+  }
+  int8_t tag = hash_h2(key->hcode);
+  size_t g = hash_h1(key->hcode) & tab->mask;
+  for (size_t step = 1; ; ++step) {
+    const int8_t *ctrl = &tab->ctrl[g * k_group];
+    for (uint32_t bits = group_match(ctrl, tag); bits; bits &= bits - 1) {
+      size_t pos = g * k_group + (size_t)__builtin_ctz(bits);
+      SNode *node = tab->slots[pos];
+      if (node->hcode == key->hcode && eq(node, key)) {
+        return pos;
+      }
+    }
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      return (size_t)-1;
+    }
+    g = (g + step) & tab->mask;
+  }
+}
+
+// insert without checking for an existing node
+static void st_insert(SwissTab *tab, SNode *node) {
+  size_t g = hash_h1(node->hcode) & tab->mask;
+  for (size_t step = 1; ; ++step) {
+    uint32_t bits = group_free(&tab->ctrl[g * k_group]);
+    if (bits) {
+      size_t pos = g * k_group + (size_t)__builtin_ctz(bits);
+      if (tab->ctrl[pos] == CTRL_EMPTY) {
+        tab->used++;
+      }
+      tab->ctrl[pos] = hash_h2(node->hcode);
+      tab->slots[pos] = node;
+      tab->size++;
+      return;
+    }
+    g = (g + step) & tab->mask;
+  }
+}
+
+static SNode *st_erase(SwissTab *tab, size_t pos) {
+  SNode *node = tab->slots[pos];
+  // no probe went past a group that still has an empty slot,
+  // so the slot can be made empty instead of a tombstone.
+  if (group_match(&tab->ctrl[pos & ~(k_group - 1)], CTRL_EMPTY)) {
+    tab->ctrl[pos] = CTRL_EMPTY;
+    tab->used--;
+  } else {
+    tab->ctrl[pos] = CTRL_DELETED;
+  }
+  tab->size--;
+  return node;
+}
+
+// the newer table is full once 7/8 of the slots are used
+static bool st_full(SwissTab *tab) {
+  return tab->used + 1 > st_cap(tab) / 8 * 7;
+}
+
+const size_t k_migrate_work = 128;
+
+// move the nodes of a few slots from the older table to the newer one
+static void sm_help_migrate(SwissMap *map, size_t nslots) {
+  SwissTab *older = &map->older;
+  if (!older->ctrl) {
+    return;
+  }
+  size_t cap = st_cap(older);
+  while (nslots-- > 0 && map->migrate_pos < cap && older->size > 0) {
+    size_t pos = map->migrate_pos++;
+    if (older->ctrl[pos] >= 0) {
+      older->ctrl[pos] = CTRL_DELETED;
+      older->size--;
+      st_insert(&map->newer, older->slots[pos]);
+    }
+  }
+  if (older->size == 0) {
+    st_free(older); // done
+  }
+}
+
+static void sm_start_resizing(SwissMap *map) {
+  // finish the previous migration first
+  sm_help_migrate(map, (size_t)-1);
+  assert(!map->older.ctrl);
+  // double when more than half of the slots are live,
+  // otherwise only clear the tombstones
+  SwissTab *newer = &map->newer;
+  size_t ngroups = newer->mask + 1;
+  if (newer->size * 2 > st_cap(newer)) {
+    ngroups *= 2;
+  }
+  map->older = *newer;
+  st_init(newer, ngroups);
+  map->migrate_pos = 0;
+}
+
+SNode *sm_lookup(SwissMap *map, SNode *key, bool (*eq)(SNode *, SNode *)) {
+  sm_help_migrate(map, k_migrate_work);
+  size_t pos = st_find(&map->newer, key, eq);
+  if (pos != (size_t)-1) {
+    return map->newer.slots[pos];
+  }
+  pos = st_find(&map->older, key, eq);
+  return pos != (size_t)-1 ? map->older.slots[pos] : NULL;
+}
+
+void sm_insert(SwissMap *map, SNode *node) {
+  if (!map->newer.ctrl) {
+    st_init(&map->newer, 1); // initialize the table if it is empty.
+  }
+  if (st_full(&map->newer)) {
+    sm_start_resizing(map);
+  }
+  st_insert(&map->newer, node);
+  sm_help_migrate(map, k_migrate_work);
+}
+
+SNode *sm_pop(SwissMap *map, SNode *key, bool (*eq)(SNode *, SNode *)) {
+  sm_help_migrate(map, k_migrate_work);
+  size_t pos = st_find(&map->newer, key, eq);
+  if (pos != (size_t)-1) {
+    return st_erase(&map->newer, pos);
+  }
+  pos = st_find(&map->older, key, eq);
+  if (pos != (size_t)-1) {
+    SNode *node = st_erase(&map->older, pos);
+    if (map->older.size == 0) {
+      st_free(&map->older);
+    }
+    return node;
+  }
+  return NULL;
+}
+
+// load the first group probed for `hcode` into the cache. issued a few
+// keys ahead of the lookups of a batch, so their cache misses overlap.
+void sm_prefetch(SwissMap *map, uint64_t hcode) {
+  SwissTab *tab = &map->newer;
+  if (tab->ctrl) {
+    size_t pos = (hash_h1(hcode) & tab->mask) * k_group;
+    __builtin_prefetch(&tab->ctrl[pos]);
+    __builtin_prefetch(&tab->slots[pos]);
+    __builtin_prefetch(&tab->slots[pos + k_group / 2]);
+  }
+}
+
+size_t sm_size(SwissMap *map) {
+  return map->newer.size + map->older.size;
+}
+
+void sm_destroy(SwissMap *map) {
+  st_free(&map->newer);
+  st_free(&map->older);
+  *map = SwissMap{};
+}
+
+static void st_foreach(SwissTab *tab, void (*f)(SNode *, void *), void *arg) {
+  size_t cap = st_cap(tab);
+  for (size_t i = 0; i < cap; ++i) {
+    if (tab->ctrl[i] >= 0) {
+      f(tab->slots[i], arg);
+    }
+  }
+}
+
+void sm_foreach(SwissMap *map, void (*f)(SNode *, void *), void *arg) {
+  st_foreach(&map->newer, f, arg);
+  st_foreach(&map->older, f, arg);
+}
+
+// call f on the nodes whose home group is g. they are on the probe
+// sequence of g, before the first group with an empty slot.
+static void st_scan_group(SwissTab *tab, size_t g, void (*f)(SNode *, void *), void *arg) {
+  size_t home = g;
+  for (size_t step = 1; ; ++step) {
+    const int8_t *ctrl = &tab->ctrl[g * k_group];
+    for (size_t i = 0; i < k_group; ++i) {
+      SNode *node = tab->slots[g * k_group + i];
+      if (ctrl[i] >= 0 && (hash_h1(node->hcode) & tab->mask) == home) {
+        f(node, arg);
+      }
+    }
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      return;
+    }
+    g = (g + step) & tab->mask;
+  }
+}
+
+static uint64_t rev64(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555) | ((v & 0x5555555555555555) << 1);
+  v = ((v >> 2) & 0x3333333333333333) | ((v & 0x3333333333333333) << 2);
+  v = ((v >> 4) & 0x0f0f0f0f0f0f0f0f) | ((v & 0x0f0f0f0f0f0f0f0f) << 4);
+  return __builtin_bswap64(v);
+}
+
+// increment the masked bits of the cursor from the high end
+static uint64_t cursor_next(uint64_t v, uint64_t mask) {
+  v |= ~mask;
+  return rev64(rev64(v) + 1);
+}
+
+// visit the nodes of a group (the one at `cursor`), and return the cursor
+// of the next one, or 0 at the end. groups are visited in the order of the
+// reversed bits of their index, so when the table doubles, the groups
+// already visited split into groups that are all behind the cursor. every
+// node present for the whole scan is visited at least once, across
+// resizes and migrations; some may be visited twice.
+uint64_t sm_scan(SwissMap *map, uint64_t cursor, void (*f)(SNode *, void *), void *arg) {
+  SwissTab *small = &map->newer;
+  SwissTab *large = &map->older;
+  if (!small->ctrl) {
+    return 0;
+  }
+  if (!large->ctrl) {
+    st_scan_group(small, cursor & small->mask, f, arg);
+    return cursor_next(cursor, small->mask);
+  }
+  if (small->mask > large->mask) {
+    std::swap(small, large);
+  }
+  // the group of the smaller table, then the ones it expands to
+  uint64_t m0 = small->mask;
+  uint64_t m1 = large->mask;
+  st_scan_group(small, cursor & m0, f, arg);
+  do {
+    st_scan_group(large, cursor & m1, f, arg);
+    cursor = cursor_next(cursor, m1);
+  } while (cursor & (m0 ^ m1));
+  return cursor;
+}
+
+// up to n nodes of consecutive groups, from a random one. not a uniform
+// sample, but enough for eviction, which wants a few keys from anywhere.
+size_t sm_sample(SwissMap *map, uint64_t rnd, SNode **out, size_t n) {
+  size_t total = map->newer.size + map->older.size;
+  if (total == 0 || n == 0) {
+    return 0;
+  }
+  // a table in proportion to its share of the nodes
+  SwissTab *tab = (rnd >> 32) % total < map->older.size ? &map->older : &map->newer;
+  size_t got = 0;
+  size_t g = (size_t)rnd & tab->mask;
+  // a mostly empty table has long runs of empty groups
+  for (size_t step = 0; step < n * 10 && step <= tab->mask && got < n; ++step) {
+    const int8_t *ctrl = &tab->ctrl[g * k_group];
+    for (size_t i = 0; i < k_group && got < n; ++i) {
+      if (ctrl[i] >= 0) {
+        out[got++] = tab->slots[g * k_group + i];
+      }
+    }
+    g = (g + 1) & tab->mask;
+  }
+  return got;
+}
+
+// bytes of the tables allocated by the calling thread, less the ones
+// freed by any thread, without the nodes. kept as the tables are resized,
+// so it covers every map of the thread without walking them.
+uint64_t sm_thread_mem() {
+  return t_tab_bytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the node embedded in the objects of a SwissMap. unlike HNode there is
+// no chain pointer, only the cached hash.
+struct SNode {
+  uint64_t hcode = 0;
+};
+
+// an open-addressing table of `SNode *` in the style of Swiss tables.
+// each slot has a 1-byte control tag: empty, deleted, or 7 bits of the
+// hash. a lookup compares the tags of 16 slots at once with SSE2 and only
+// follows the pointers whose tag matches, instead of walking a chain.
+struct SwissTab {
+  int8_t *ctrl = NULL; // a tag per slot
+  SNode **slots = NULL;
+  size_t mask = 0; // number of groups - 1
+  size_t size = 0; // live nodes
+  size_t used = 0; // live and deleted slots
+};
+
+// like HMap, resizing moves a few slots per operation from the older
+// table to the newer one, so a rehash is never done all at once.
+struct SwissMap {
+  SwissTab newer;
+  SwissTab older;
+  size_t migrate_pos = 0;
+};
+
+SNode *sm_lookup(SwissMap *map, SNode *key, bool (*eq)(SNode *, SNode *));
+void sm_insert(SwissMap *map, SNode *node);
+SNode *sm_pop(SwissMap *map, SNode *key, bool (*eq)(SNode *, SNode *));
+void sm_prefetch(SwissMap *map, uint64_t hcode);
+size_t sm_size(SwissMap *map);
+void sm_destroy(SwissMap *map);
+void sm_foreach(SwissMap *map, void (*f)(SNode *, void *), void *arg);
+uint64_t sm_scan(SwissMap *map, uint64_t cursor, void (*f)(SNode *, void *), void *arg);
+size_t sm_sample(SwissMap *map, uint64_t rnd, SNode **out, size_t n);
+uint64_t sm_thread_mem();
+size_t st_cap(SwissTab *tab);
@@ -0,0 +1,146 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <map>
+#include "common.h"
+#include "swisstable.h"
+
+struct Data {
+  SNode node;
+  uint32_t val = 0;
+};
+
+static bool data_eq(SNode *lhs, SNode *rhs) {
+  return container_of(lhs, Data, node)->val == container_of(rhs, Data, node)->val;
+}
+
+// a weak hash, so that tags and groups collide a lot
+static uint64_t val_hash(uint32_t val) {
+  return (uint64_t)val * 0x9E3779B1u % 100003;
+}
+
+static Data *lookup(SwissMap &map, uint32_t val) {
+  Data key;
+  key.val = val;
+  key.node.hcode = val_hash(val);
+  SNode *node = sm_lookup(&map, &key.node, &data_eq);
+  return node ? container_of(node, Data, node) : NULL;
+}
+
+static bool del(SwissMap &map, uint32_t val) {
+  Data key;
+  key.val = val;
+  key.node.hcode = val_hash(val);
+  SNode *node = sm_pop(&map, &key.node, &data_eq);
+  delete (node ? container_of(node, Data, node) : NULL);
+  return node != NULL;
+}
+
+static void cb_count(SNode *node, void *arg) {
+  std::map<uint32_t, int> &seen = *(std::map<uint32_t, int> *)arg;
+  seen[container_of(node, Data, node)->val]++;
+}
+
+static void verify(SwissMap &map, const std::map<uint32_t, bool> &ref) {
+  assert(sm_size(&map) == ref.size());
+  std::map<uint32_t, int> seen;
+  sm_foreach(&map, &cb_count, &seen);
+  assert(seen.size() == ref.size());
+  for (auto &kv : seen) {
+    assert(kv.second == 1 && ref.count(kv.first));
+  }
+  // a sample has distinct live nodes
+  SNode *nodes[5];
+  size_t got = sm_sample(&map, ((uint64_t)rand() << 31) ^ (uint64_t)rand(), nodes, 5);
+  assert(got <= 5 && (got == 0 || !ref.empty()));
+  std::map<uint32_t, int> sampled;
+  for (size_t i = 0; i < got; ++i) {
+    uint32_t val = container_of(nodes[i], Data, node)->val;
+    assert(ref.count(val) && ++sampled[val] == 1);
+  }
+  // the only map of the thread
+  size_t cap = st_cap(&map.newer) + st_cap(&map.older);
+  assert(sm_thread_mem() == cap * (1 + sizeof(SNode *)));
+}
+
+// a scan interleaved with inserts and deletes, through resizes. every
+// value present for the whole scan must be visited.
+static void test_scan(uint32_t n) {
+  SwissMap map;
+  for (uint32_t val = 0; val < n; ++val) {
+    Data *data = new Data();
+    data->val = val;
+    data->node.hcode = val_hash(val);
+    sm_insert(&map, &data->node);
+  }
+  std::map<uint32_t, int> seen;
+  std::map<uint32_t, bool> deleted;
+  uint32_t next = n;
+  uint64_t cursor = 0;
+  do {
+    cursor = sm_scan(&map, cursor, &cb_count, &seen);
+    // grow the map, and delete some of the original values
+    for (int i = 0; i < 3; ++i) {
+      Data *data = new Data();
+      data->val = next++;
+      data->node.hcode = val_hash(data->val);
+      sm_insert(&map, &data->node);
+    }
+    uint32_t val = (uint32_t)rand() % (n + 1);
+    if (val < n && !deleted[val]) {
+      deleted[val] = del(map, val);
+    }
+  } while (cursor != 0);
+  for (uint32_t val = 0; val < n; ++val) {
+    assert(deleted[val] || seen.count(val));
+  }
+  for (uint32_t val = 0; val < next; ++val) {
+    if (val >= n || !deleted[val]) {
+      assert(del(map, val));
+    }
+  }
+  sm_destroy(&map);
+}
+
+int main() {
+  SwissMap map;
+  std::map<uint32_t, bool> ref;
+  assert(!lookup(map, 1));
+  assert(!del(map, 1));
+
+  // random inserts and deletes, through many resizes and tombstones
+  for (uint32_t i = 0; i < 200000; ++i) {
+    uint32_t val = (uint32_t)rand() % 20000;
+    if (rand() % 3 == 0) {
+      assert(del(map, val) == (ref.erase(val) > 0));
+    } else if (!lookup(map, val)) {
+      Data *data = new Data();
+      data->val = val;
+      data->node.hcode = val_hash(val);
+      sm_insert(&map, &data->node);
+      ref[val] = true;
+    }
+    if (i % 10000 == 0) {
+      verify(map, ref);
+    }
+  }
+  verify(map, ref);
+  for (uint32_t val = 0; val < 20000; ++val) {
+    Data *data = lookup(map, val);
+    assert(ref.count(val) ? data && data->val == val : !data);
+  }
+
+  // delete everything
+  for (auto &kv : ref) {
+    assert(del(map, kv.first));
+  }
+  ref.clear();
+  verify(map, ref);
+  sm_destroy(&map);
+  assert(sm_thread_mem() == 0);
+
+  for (uint32_t n : {0, 1, 100, 5000, 50000}) {
+    test_scan(n);
+  }
+  return 0;
+}
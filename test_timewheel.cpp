@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <set>
+#include <vector>
+#include "common.h"
+#include "timewheel.h"
+
+static uint64_t rand64() {
+    return ((uint64_t)rand() << 31) ^ (uint64_t)rand();
+}
+
+// a distance from a few ticks to beyond the top level
+static uint64_t rand_delay() {
+    switch (rand() % 5) {
+    case 0: return (uint64_t)rand() % 10;
+    case 1: return (uint64_t)rand() % 300;
+    case 2: return (uint64_t)rand() % 100000;
+    case 3: return rand64() % ((uint64_t)1 << 34);
+    default: return (uint64_t)rand() % 3000;
+    }
+}
+
+struct Timer {
+    TWTimer tw;
+    bool armed = false;
+};
+
+typedef std::set<std::pair<uint64_t, Timer *>> Ref;
+
+// pop everything due before `now` and compare with the reference
+static void advance(TWheel &tw, Ref &ref, uint64_t now) {
+    uint64_t next = tw_next(&tw);
+    assert(ref.empty() ? next == (uint64_t)-1
+        : next <= ref.begin()->first + 1 || next == tw.time + 1);
+    while (TWTimer *t = tw_pop(&tw, now)) {
+        Timer *timer = container_of(t, Timer, tw);
+        assert(t->expire < now && timer->armed && !tw_armed(t));
+        assert(ref.erase({t->expire, timer}) == 1);
+        timer->armed = false;
+    }
+    assert(ref.empty() || ref.begin()->first >= now);
+    assert(tw.size == ref.size());
+}
+
+static void test_random(uint64_t start, size_t ntimers, int nsteps) {
+    TWheel *tw = new TWheel();
+    tw_init(tw, start);
+    std::vector<Timer> timers(ntimers);
+    Ref ref;
+    uint64_t now = start;
+    for (int step = 0; step < nsteps; ++step) {
+        Timer *timer = &timers[(size_t)rand() % ntimers];
+        int r = rand() % 10;
+        if (r < 6) {
+            // arm or re-arm, sometimes overdue
+            uint64_t expire = now + rand_delay();
+            expire = (rand() % 20 == 0 && expire > 5) ? expire - 5 : expire;
+            if (timer->armed) {
+                ref.erase({timer->tw.expire, timer});
+            }
+            tw_add(tw, &timer->tw, expire);
+            ref.insert({expire, timer});
+            timer->armed = true;
+        } else if (r < 8) {
+            if (timer->armed) {
+                ref.erase({timer->tw.expire, timer});
+            }
+            tw_del(tw, &timer->tw);
+            timer->armed = false;
+        } else if (r < 9) {
+            // jump ahead, sometimes far
+            now += rand() % 50 == 0 ? rand_delay() : (uint64_t)rand() % 20;
+            advance(*tw, ref, now);
+        } else if (timer->armed) {
+            // the owner is reallocated
+            Timer moved;
+            tw_move(&timer->tw, &moved.tw);
+            assert(!tw_armed(&timer->tw) && tw_armed(&moved.tw));
+            tw_move(&moved.tw, &timer->tw);
+        }
+    }
+    // run everything out
+    while (!ref.empty()) {
+        now = ref.rbegin()->first + 1 - (uint64_t)(rand() % 2) * (ref.rbegin()->first - now) / 2;
+        advance(*tw, ref, now);
+    }
+    assert(tw_next(tw) == (uint64_t)-1);
+    delete tw;
+}
+
+int main() {
+    test_random(0, 100, 100000);
+    test_random(123456789, 1000, 200000);
+    test_random(((uint64_t)1 << 32) - 1000, 1000, 200000); // across the top level
+    test_random(1000, 100000, 400000);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "zset.h"
+
+typedef std::set<std::pair<double, std::string>> Ref;
+
+// every member in order, by both the range query and the offsets
+static void verify(ZSet *zset, const Ref &ref) {
+    assert(zset_size(zset) == ref.size());
+    ZNode *node = zset_query(zset, -1e300, "", 0);
+    ZNode *first = node;
+    int64_t i = 0;
+    for (auto &p : ref) {
+        assert(node && node->score == p.first);
+        assert(std::string(node->name, node->len) == p.second);
+        ZNode *found = zset_lookup(zset, p.second.data(), p.second.size());
+        assert(found && found->score == p.first);
+        assert(zset_rank(zset, found) == i);
+        assert(zset_select(zset, i) == node);
+        assert(znode_offset(zset, first, i) == node);
+        node = znode_offset(zset, node, +1);
+        i++;
+    }
+    assert(!node);
+    assert(!zset_select(zset, -1) && !zset_select(zset, i));
+    if (first) {
+        assert(!znode_offset(zset, first, -1));
+    }
+}
+
+static void test_random(size_t max_n, size_t max_len, int nnames, int nsteps) {
+    g_zset_pack_max_n = max_n;
+    g_zset_pack_max_len = max_len;
+    ZSet zset;
+    Ref ref;
+    std::map<std::string, double> scores;
+    for (int step = 0; step < nsteps; ++step) {
+        int r = rand() % 10;
+        std::string name = "m" + std::to_string(rand() % nnames);
+        if (rand() % 50 == 0) {
+            name += std::string(40, 'x'); // past the length limit
+        }
+        if (r < 6) {
+            double score = rand() % 20;
+            bool added = zset_add(&zset, name.data(), name.size(), score);
+            assert(added == !scores.count(name));
+            if (!added) {
+                ref.erase({scores[name], name});
+            }
+            scores[name] = score;
+            ref.insert({score, name});
+        } else {
+            ZNode *node = zset_pop(&zset, name.data(), name.size());
+            assert((node != NULL) == (scores.count(name) > 0));
+            if (node) {
+                assert(node->score == scores[name]);
+                znode_del(node);
+                ref.erase({scores[name], name});
+                scores.erase(name);
+            }
+        }
+        if (step % (nsteps / 30) == 0) {
+            verify(&zset, ref);
+        }
+    }
+    verify(&zset, ref);
+    zset_dispose(&zset);
+}
+
+static void test_build(size_t n) {
+    g_zset_pack_max_n = 16;
+    g_zset_pack_max_len = 16;
+    std::vector<ZNode *> nodes;
+    Ref ref;
+    for (size_t i = 0; i < n; ++i) {
+        std::string name = "n" + std::to_string(i);
+        nodes.push_back(znode_new(name.data(), name.size(), (double)(i / 3)));
+        ref.insert({(double)(i / 3), name});
+    }
+    std::sort(nodes.begin(), nodes.end(), [](ZNode *a, ZNode *b) {
+        return std::make_pair(a->score, std::string(a->name, a->len))
+            < std::make_pair(b->score, std::string(b->name, b->len));
+    });
+    ZSet zset;
+    assert(zset_build(&zset, nodes.data(), nodes.size()));
+    assert((zset.pack != NULL) == (n > 0 && n <= 16));
+    verify(&zset, ref);
+    zset_dispose(&zset);
+}
+
+int main() {
+    for (int index : {ZINDEX_AVL, ZINDEX_BTREE}) {
+        g_zset_index = index;
+        test_random(8, 16, 300, 3000);
+        test_random(128, 64, 300, 3000);
+        test_random(0, 0, 300, 3000); // always a tree
+        test_random(0, 0, 20000, 100000); // a deeper one
+        for (size_t n : {0, 1, 5, 16, 17, 100, 5000}) {
+            test_build(n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "common.h"
+#include "timewheel.h"
+
+const uint32_t k_tw_mask = k_tw_slots - 1;
+
+static uint32_t slot_index(uint64_t tick, uint32_t level) {
+    return (uint32_t)(tick >> (level * k_tw_bits)) & k_tw_mask;
+}
+
+static void slot_mark(TWheel *tw, uint32_t level, uint32_t i) {
+    tw->used[level][i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static void slot_unmark(TWheel *tw, uint32_t level, uint32_t i) {
+    tw->used[level][i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+void tw_init(TWheel *tw, uint64_t now) {
+    tw->time = now;
+    tw->size = 0;
+    for (uint32_t level = 0; level < k_tw_levels; ++level) {
+        for (uint32_t i = 0; i < k_tw_slots; ++i) {
+            dlist_init(&tw->slots[level][i]);
+        }
+        for (uint64_t &bits : tw->used[level]) {
+            bits = 0;
+        }
+    }
+}
+
+bool tw_armed(TWTimer *timer) {
+    return timer->node.next != NULL;
+}
+
+// put the timer in the lowest level whose range covers its distance.
+// an overdue timer goes to the front of the current slot.
+static void tw_link(TWheel *tw, TWTimer *timer) {
+    uint64_t expire = timer->expire < tw->time ? tw->time : timer->expire;
+    uint64_t delta = expire - tw->time;
+    uint32_t level = 0;
+    while (level + 1 < k_tw_levels && delta >> ((level + 1) * k_tw_bits)) {
+        level++;
+    }
+    if (delta >> (k_tw_levels * k_tw_bits)) {
+        // beyond the top level, wait in its last slot and be placed again
+        expire = tw->time + ((uint64_t)1 << (k_tw_levels * k_tw_bits)) - 1;
+    }
+    uint32_t i = slot_index(expire, level);
+    DList *slot = &tw->slots[level][i];
+    dlist_insert_before(timer->expire < tw->time ? slot->next : slot, &timer->node);
+    slot_mark(tw, level, i);
+}
+
+static void tw_unlink(TWheel *tw, TWTimer *timer) {
+    DList *prev = timer->node.prev;
+    DList *next = timer->node.next;
+    dlist_detach(&timer->node);
+    if (prev == next) {
+        // it was the last one, so `prev` is the slot
+        size_t pos = (size_t)(prev - &tw->slots[0][0]);
+        slot_unmark(tw, (uint32_t)(pos / k_tw_slots), (uint32_t)(pos % k_tw_slots));
+    }
+    timer->node.prev = timer->node.next = NULL;
+}
+
+// arm or re-arm a timer for the tick `expire`
+void tw_add(TWheel *tw, TWTimer *timer, uint64_t expire) {
+    if (tw_armed(timer)) {
+        tw_unlink(tw, timer);
+    } else {
+        tw->size++;
+    }
+    timer->expire = expire;
+    tw_link(tw, timer);
+}
+
+// cancel a timer, if it is armed
+void tw_del(TWheel *tw, TWTimer *timer) {
+    if (tw_armed(timer)) {
+        tw_unlink(tw, timer);
+        tw->size--;
+    }
+}
+
+// the object holding a timer was moved, take over its place in the wheel
+void tw_move(TWTimer *from, TWTimer *to) {
+    to->expire = from->expire;
+    to->node.prev = to->node.next = NULL;
+    if (tw_armed(from)) {
+        dlist_insert_before(&from->node, &to->node);
+        dlist_detach(&from->node);
+        from->node.prev = from->node.next = NULL;
+    }
+}
+
+// the slot of the level that starts at the current tick is due,
+// its timers move down to the levels below.
+static void tw_cascade(TWheel *tw, uint32_t level) {
+    uint32_t i = slot_index(tw->time, level);
+    DList *slot = &tw->slots[level][i];
+    if (dlist_empty(slot)) {
+        return;
+    }
+    DList list;
+    list.next = slot->next;
+    list.prev = slot->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    dlist_init(slot);
+    slot_unmark(tw, level, i);
+    while (!dlist_empty(&list)) {
+        TWTimer *timer = container_of(list.next, TWTimer, node);
+        dlist_detach(&timer->node);
+        tw_link(tw, timer);
+    }
+}
+
+static void tw_seek(TWheel *tw, uint64_t time) {
+    tw->time = time;
+    for (uint32_t level = 1; level < k_tw_levels; ++level) {
+        if (time & (((uint64_t)1 << (level * k_tw_bits)) - 1)) {
+            break; // not the start of a slot of this level
+        }
+        tw_cascade(tw, level);
+    }
+}
+
+// the distance from slot i to the next non-empty slot of the level,
+// wrapping around. k_tw_slots if they are all empty.
+static uint32_t next_used(TWheel *tw, uint32_t level, uint32_t i) {
+    for (uint32_t d = 0; d < k_tw_slots;) {
+        uint32_t j = (i + d) & k_tw_mask;
+        uint64_t bits = tw->used[level][j / 64] >> (j % 64);
+        if (bits) {
+            d += (uint32_t)__builtin_ctzll(bits);
+            return d < k_tw_slots ? d : k_tw_slots;
+        }
+        d += 64 - j % 64;
+    }
+    return k_tw_slots;
+}
+
+// the next tick with timers to expire or to move down a level,
+// (uint64_t)-1 if there are no timers.
+static uint64_t tw_next_tick(TWheel *tw) {
+    if (tw->size == 0) {
+        return (uint64_t)-1;
+    }
+    uint64_t next = (uint64_t)-1;
+    uint32_t d = next_used(tw, 0, slot_index(tw->time, 0));
+    if (d < k_tw_slots) {
+        next = tw->time + d;
+    }
+    for (uint32_t level = 1; level < k_tw_levels; ++level) {
+        // the current slot of a level above 0 is a whole round away
+        uint32_t shift = level * k_tw_bits;
+        d = next_used(tw, level, (slot_index(tw->time, level) + 1) & k_tw_mask);
+        uint64_t start = ((tw->time >> shift) + d + 1) << shift;
+        if (d < k_tw_slots && start < next) {
+            next = start;
+        }
+    }
+    return next;
+}
+
+// the earliest `now` at which tw_pop() has work to do,
+// (uint64_t)-1 if there are no timers.
+uint64_t tw_next(TWheel *tw) {
+    uint64_t tick = tw_next_tick(tw);
+    return tick == (uint64_t)-1 ? tick : tick + 1;
+}
+
+// take out a timer that expired before `now`, or return NULL.
+// the ticks with nothing to do are skipped over.
+TWTimer *tw_pop(TWheel *tw, uint64_t now) {
+    while (true) {
+        // the earliest timer of the current slot is first
+        DList *slot = &tw->slots[0][slot_index(tw->time, 0)];
+        if (!dlist_empty(slot)) {
+            TWTimer *timer = container_of(slot->next, TWTimer, node);
+            if (timer->expire < now) {
+                tw_unlink(tw, timer);
+                tw->size--;
+                return timer;
+            }
+        }
+        if (tw->time >= now) {
+            return NULL;
+        }
+        if (tw->size == 0) {
+            tw->time = now;
+            return NULL;
+        }
+        uint64_t next = tw_next_tick(tw);
+        tw_seek(tw, next < now ? next : now);
+    }
+}
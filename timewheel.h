@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "linked_list.h"
+
+// a timer embedded in the object it expires
+struct TWTimer {
+    DList node; // in a slot of the wheel, NULL links when not armed
+    uint64_t expire = 0; // the tick, in ms
+};
+
+const uint32_t k_tw_bits = 8;
+const uint32_t k_tw_slots = 1 << k_tw_bits;
+const uint32_t k_tw_levels = 4;
+
+// a hierarchical timing wheel with 1 ms ticks. level 0 has a slot per
+// tick for the next 256 ms, each level above has slots 256 times wider.
+// a timer waits in the level that fits its distance, and moves down a
+// level when the ticks reach its slot, so arming and cancelling are O(1).
+// timers further than 2^32 ms away wait in the top level.
+struct TWheel {
+    uint64_t time = 0; // the next tick to process
+    size_t size = 0; // armed timers
+    DList slots[k_tw_levels][k_tw_slots];
+    // a bit per non-empty slot, to skip over the empty ones
+    uint64_t used[k_tw_levels][k_tw_slots / 64] = {};
+};
+
+void tw_init(TWheel *tw, uint64_t now);
+bool tw_armed(TWTimer *timer);
+void tw_add(TWheel *tw, TWTimer *timer, uint64_t expire);
+void tw_del(TWheel *tw, TWTimer *timer);
+void tw_move(TWTimer *from, TWTimer *to);
+TWTimer *tw_pop(TWheel *tw, uint64_t now);
+uint64_t tw_next(TWheel *tw);
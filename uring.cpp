@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "uring.h"
+
+// returns -1 if io_uring is missing or too old for this backend.
+int uring_init(Uring *ring, unsigned entries) {
+  io_uring_params p = {};
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0) {
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+    close(fd);
+    return -1;
+  }
+
+  // the SQ and CQ rings share one mapping
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  size_t size = sq_size > cq_size ? sq_size : cq_size;
+  uint8_t *ptr = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ptr == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  void *sqes = mmap(NULL, p.sq_entries * sizeof(io_uring_sqe),
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+
+  ring->fd = fd;
+  ring->sq_head = (unsigned *)(ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(ptr + p.sq_off.tail);
+  ring->sq_array = (unsigned *)(ptr + p.sq_off.array);
+  ring->sq_mask = *(unsigned *)(ptr + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->sqes = (io_uring_sqe *)sqes;
+  ring->cq_head = (unsigned *)(ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(ptr + p.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(ptr + p.cq_off.ring_mask);
+  ring->cqes = (io_uring_cqe *)(ptr + p.cq_off.cqes);
+  return 0;
+}
+
+static void uring_provide(Uring *ring, uint16_t bid, uint16_t n) {
+  io_uring_sqe *sqe = uring_sqe(ring);
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = n;
+  sqe->addr = (uint64_t)uring_buf(ring, bid);
+  sqe->len = ring->buf_size;
+  sqe->off = bid;
+  sqe->buf_group = ring->bgid;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  sqe->user_data = 0;
+}
+
+// provide `nbufs` buffers of `size` bytes for IOSQE_BUFFER_SELECT.
+// uses IORING_OP_PROVIDE_BUFFERS, the recycling SQEs ride along with the
+// next submission so they cost no extra syscall.
+int uring_bufs_init(Uring *ring, uint16_t bgid, uint16_t nbufs, uint32_t size) {
+  ring->bgid = bgid;
+  ring->buf_size = size;
+  ring->bufs = (uint8_t *)malloc((size_t)nbufs * size);
+  if (!ring->bufs) {
+    die("out of memory");
+  }
+  uring_provide(ring, 0, nbufs);
+  return 0;
+}
+
+// get a zeroed SQE. it is submitted by the next uring_enter().
+io_uring_sqe *uring_sqe(Uring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    // full, submit what we have without waiting
+    if (uring_enter(ring, 0) < 0) {
+      die("io_uring_enter");
+    }
+  }
+  unsigned idx = ring->sq_local_tail & ring->sq_mask;
+  io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[idx] = idx;
+  ring->sq_local_tail++;
+  return sqe;
+}
+
+// submit the queued SQEs. if `timeout_ms` is not 0, also wait for at
+// least one completion or the timeout (-1 means no timeout).
+int uring_enter(Uring *ring, int timeout_ms) {
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  unsigned submit = ring->sq_local_tail - *ring->sq_head;
+  if (submit == 0 && timeout_ms == 0) {
+    return 0;
+  }
+
+  unsigned flags = 0;
+  unsigned wait_nr = 0;
+  io_uring_getevents_arg arg = {};
+  struct __kernel_timespec ts = {};
+  if (timeout_ms != 0) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    wait_nr = 1;
+    if (timeout_ms > 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+      arg.ts = (uint64_t)&ts;
+    }
+  }
+  int rv = (int)syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr,
+    flags, flags ? &arg : NULL, flags ? sizeof(arg) : 0);
+  if (rv < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) {
+    return 0; // timed out, interrupted or the CQ needs draining first
+  }
+  return rv;
+}
+
+// the next completion, or NULL.
+io_uring_cqe *uring_cqe(Uring *ring) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_done(Uring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t *uring_buf(Uring *ring, uint16_t bid) {
+  return ring->bufs + (size_t)bid * ring->buf_size;
+}
+
+// give a provided buffer back to the kernel
+void uring_buf_recycle(Uring *ring, uint16_t bid) {
+  uring_provide(ring, bid, 1);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// a minimal io_uring wrapper over the raw syscalls.
+// SQEs are batched and only submitted by uring_enter().
+struct Uring {
+  int fd = -1;
+  // submission queue
+  unsigned *sq_head = NULL;
+  unsigned *sq_tail = NULL;
+  unsigned *sq_array = NULL;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned sq_local_tail = 0; // queued but not yet published
+  io_uring_sqe *sqes = NULL;
+  // completion queue
+  unsigned *cq_head = NULL;
+  unsigned *cq_tail = NULL;
+  unsigned cq_mask = 0;
+  io_uring_cqe *cqes = NULL;
+  // provided buffers for recv
+  uint16_t bgid = 0;
+  uint32_t buf_size = 0;
+  uint8_t *bufs = NULL;
+};
+
+int uring_init(Uring *ring, unsigned entries);
+int uring_bufs_init(Uring *ring, uint16_t bgid, uint16_t nbufs, uint32_t size);
+io_uring_sqe *uring_sqe(Uring *ring);
+int uring_enter(Uring *ring, int timeout_ms);
+io_uring_cqe *uring_cqe(Uring *ring);
+void uring_cqe_done(Uring *ring);
+uint8_t *uring_buf(Uring *ring, uint16_t bid);
+void uring_buf_recycle(Uring *ring, uint16_t bid);
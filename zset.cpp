@@ -1,78 +1,291 @@
 #include <stdlib.h>
 #include <string.h>
+#include <new>
 #include <string>
+#include <vector>
 #include "common.h"
 #include "zset.h"
+#include "slab.h"
 
-static ZNode *znode_new(const char *name, size_t len, double score) {
-    ZNode *node = (ZNode *)malloc(sizeof(ZNode) + len);
-    avl_init(&node->tree);
-    node->hmap.next = NULL;
-    node->hmap.hcode = str_hash((uint8_t *)name, len);
+size_t g_zset_pack_max_n = 128;
+size_t g_zset_pack_max_len = 64;
+int g_zset_index = ZINDEX_AVL;
+
+// a member of the tree encoding has its index nodes in front of it:
+//   AVL:     [AVLNode][SNode][ZNode]
+//   B+tree:           [SNode][ZNode], the B+tree points to the ZNode
+static bool use_btree() {
+    return g_zset_index == ZINDEX_BTREE;
+}
+
+static size_t prefix_size() {
+    return sizeof(SNode) + (use_btree() ? 0 : sizeof(AVLNode));
+}
+
+static SNode *znode_hmap(ZNode *node) {
+    return (SNode *)node - 1;
+}
+
+static ZNode *hmap_znode(SNode *hnode) {
+    return (ZNode *)(hnode + 1);
+}
+
+static AVLNode *znode_avl(ZNode *node) {
+    return (AVLNode *)znode_hmap(node) - 1;
+}
+
+static ZNode *tree_znode(AVLNode *tree) {
+    return hmap_znode((SNode *)(tree + 1));
+}
+
+ZNode *znode_new(const char *name, size_t len, double score) {
+    char *mem = (char *)slab_alloc(prefix_size() + sizeof(ZNode) + len);
+    ZNode *node = (ZNode *)(mem + prefix_size());
+    if (!use_btree()) {
+        avl_init(znode_avl(node));
+    }
+    znode_hmap(node)->hcode = str_hash((uint8_t *)name, len);
     node->score = score;
     node->len = len;
     memcpy(&node->name[0], name, len);
     return node;
 }
 
+// deallocate the node
+void znode_del(ZNode *node) {
+    slab_free((char *)node - prefix_size(), prefix_size() + sizeof(ZNode) + node->len);
+}
+
+// compare by (score, name)
+static bool zless(ZNode *node, double score, const char *name, size_t len) {
+    if (node->score != score) {
+        return node->score < score;
+    }
+    int rv = memcmp(node->name, name, min(node->len, len));
+    if (rv != 0) {
+        return rv < 0;
+    }
+    return node->len < len;
+}
+
+static bool zless(ZNode *lhs, ZNode *rhs) {
+    return zless(lhs, rhs->score, rhs->name, rhs->len);
+}
+
+// the packed encoding, a single buffer:
+//   [ZPack][records ...][free space][off[0] ... off[n - 1]]
+// records are ZNodes padded to 8 bytes, in insertion order.
+// the offsets at the end are in (score, name) order for binary search.
+struct ZPack {
+    uint32_t n = 0; // members
+    uint32_t used = 0; // bytes of records
+    uint32_t cap = 0; // bytes after the header
+    uint32_t reserved = 0;
+    char data[0];
+};
+
+static size_t rec_size(size_t len) {
+    return (sizeof(ZNode) + len + 7) & ~(size_t)7;
+}
+
+static uint32_t *pack_offs(ZPack *pack) {
+    return (uint32_t *)(pack->data + pack->cap) - pack->n;
+}
+
+static ZNode *pack_at(ZPack *pack, size_t i) {
+    return (ZNode *)(pack->data + pack_offs(pack)[i]);
+}
+
+static ZPack *pack_new(size_t cap) {
+    ZPack *pack = new (slab_alloc(sizeof(ZPack) + cap)) ZPack();
+    pack->cap = (uint32_t)cap;
+    return pack;
+}
+
+static void pack_free(ZPack *pack) {
+    slab_free(pack, sizeof(ZPack) + pack->cap);
+}
+
+// make room for a record of `len` and its offset
+static void pack_reserve(ZSet *zset, size_t len) {
+    ZPack *pack = zset->pack;
+    size_t need = pack->used + (pack->n + 1) * sizeof(uint32_t) + rec_size(len);
+    if (need <= pack->cap) {
+        return;
+    }
+    size_t cap = max(need, (size_t)pack->cap * 2);
+    cap = (cap + 7) & ~(size_t)7;
+    ZPack *grown = pack_new(cap);
+    grown->n = pack->n;
+    grown->used = pack->used;
+    memcpy(grown->data, pack->data, pack->used);
+    memcpy(pack_offs(grown), pack_offs(pack), pack->n * sizeof(uint32_t));
+    pack_free(pack);
+    zset->pack = grown;
+}
+
+// the first position not less than (score, name)
+static size_t pack_lower_bound(ZPack *pack, double score, const char *name, size_t len) {
+    size_t lo = 0, hi = pack->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (zless(pack_at(pack, mid), score, name, len)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t pack_index(ZPack *pack, ZNode *node) {
+    return pack_lower_bound(pack, node->score, node->name, node->len);
+}
+
+static void offs_insert(ZPack *pack, size_t i, uint32_t off) {
+    uint32_t *offs = pack_offs(pack);
+    memmove(offs - 1, offs, i * sizeof(uint32_t));
+    offs[i - 1] = off;
+    pack->n++;
+}
+
+static void offs_erase(ZPack *pack, size_t i) {
+    uint32_t *offs = pack_offs(pack);
+    memmove(offs + 1, offs, i * sizeof(uint32_t));
+    pack->n--;
+}
+
+// names are not hashed, a linear scan is fast enough for a small set
+static ZNode *pack_lookup(ZPack *pack, const char *name, size_t len) {
+    for (size_t i = 0; i < pack->n; ++i) {
+        ZNode *node = pack_at(pack, i);
+        if (node->len == len && 0 == memcmp(node->name, name, len)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void pack_add(ZSet *zset, const char *name, size_t len, double score) {
+    pack_reserve(zset, len);
+    ZPack *pack = zset->pack;
+    uint32_t off = pack->used;
+    ZNode *node = (ZNode *)(pack->data + off);
+    node->score = score;
+    node->len = len;
+    memcpy(node->name, name, len);
+    pack->used += (uint32_t)rec_size(len);
+    offs_insert(pack, pack_lower_bound(pack, score, name, len), off);
+}
+
+static void pack_update(ZPack *pack, ZNode *node, double score) {
+    uint32_t off = (uint32_t)((char *)node - pack->data);
+    offs_erase(pack, pack_index(pack, node));
+    node->score = score;
+    offs_insert(pack, pack_index(pack, node), off);
+}
+
+// remove the record and close the gap
+static void pack_del(ZPack *pack, ZNode *node) {
+    uint32_t off = (uint32_t)((char *)node - pack->data);
+    uint32_t size = (uint32_t)rec_size(node->len);
+    offs_erase(pack, pack_index(pack, node));
+    memmove(pack->data + off, pack->data + off + size, pack->used - off - size);
+    pack->used -= size;
+    uint32_t *offs = pack_offs(pack);
+    for (size_t i = 0; i < pack->n; ++i) {
+        if (offs[i] > off) {
+            offs[i] -= size;
+        }
+    }
+}
+
+static bool pack_fits(size_t n, size_t len) {
+    return n <= g_zset_pack_max_n && len <= g_zset_pack_max_len;
+}
+
 struct HKey {
-    HNode node;
+    SNode node;
     const char *name = NULL;
     size_t len = 0;
 };
 
-static bool hcmp(HNode *node, HNode *key) {
-    ZNode *znode = container_of(node, ZNode, hmap);
+static bool hcmp(SNode *node, SNode *key) {
+    ZNode *znode = hmap_znode(node);
     HKey *hkey = container_of(key, HKey, node);
     if (znode->len != hkey->len) {
         return false;
-    } 
+    }
     return 0 == memcmp(znode->name, hkey->name, znode->len);
 }
 
 
 // lookup by name
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len) {
-    if (!zset->tree) {
+    if (zset->pack) {
+        return pack_lookup(zset->pack, name, len);
+    }
+    if (!zset->tree && !zset->btree.root) {
         return NULL;
     }
     HKey key;
     key.node.hcode = str_hash((uint8_t *)name, len);
     key.name = name;
     key.len = len;
-    HNode *found = hm_lookup(&zset->hmap, &key.node, &hcmp);
-    return found ? container_of(found, ZNode, hmap) : NULL;
+    SNode *found = sm_lookup(&zset->hmap, &key.node, &hcmp);
+    return found ? hmap_znode(found) : NULL;
 }
 
-// compare by (score, name)
-static bool zless(AVLNode *lhs, double score, const char *name, size_t len) {
-    ZNode *node = container_of(lhs, ZNode, tree);
-    if (node->score != score) {
-        return node->score < score;
-    }
-    int rv = memcmp(node->name, name, min(node->len, len));
-    if (rv != 0) {
-        return rv < 0;
+// prefetch the hash index for a later lookup of the name
+void zset_prefetch(ZSet *zset, const char *name, size_t len) {
+    if (!zset->pack) {
+        sm_prefetch(&zset->hmap, str_hash((uint8_t *)name, len));
     }
-    return node->len < len;
-}
-
-static bool zless(AVLNode *lhs, AVLNode *rhs) {
-    ZNode *node = container_of(rhs, ZNode, tree);
-    return zless(lhs, node->score, node->name, node->len);
 }
 
-// insert into the avl 
+// insert into the ordered index
 static void tree_add(ZSet *zset, ZNode *node) {
+    if (use_btree()) {
+        return bt_insert(&zset->btree, node);
+    }
+    AVLNode *tnode = znode_avl(node);
     AVLNode *cur = NULL; // current node
     AVLNode **from = &zset->tree; // incoming point to the next node
     while (*from) { // tree search
         cur = *from;
-        from = zless(&node->tree, cur) ? &cur->left : &cur->right;
+        from = zless(node, tree_znode(cur)) ? &cur->left : &cur->right;
+    }
+    *from = tnode; // attach a new node
+    tnode->parent = cur;
+    zset->tree = avl_fix(tnode);
+}
+
+// build the tree encoding from nodes in order, O(n)
+static void tree_build(ZSet *zset, ZNode **nodes, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        sm_insert(&zset->hmap, znode_hmap(nodes[i]));
+    }
+    if (use_btree()) {
+        return bt_build(&zset->btree, nodes, n);
+    }
+    std::vector<AVLNode *> tree(n);
+    for (size_t i = 0; i < n; ++i) {
+        tree[i] = znode_avl(nodes[i]);
     }
-    *from = &node->tree; // attach a new node
-    node->tree.parent = cur;
-    zset->tree = avl_fix(&node->tree);
+    zset->tree = avl_build(tree.data(), n);
+}
+
+// the packed zset outgrew the encoding
+static void pack_convert(ZSet *zset) {
+    ZPack *pack = zset->pack;
+    std::vector<ZNode *> nodes(pack->n);
+    for (size_t i = 0; i < pack->n; ++i) {
+        ZNode *rec = pack_at(pack, i);
+        nodes[i] = znode_new(rec->name, rec->len, rec->score);
+    }
+    pack_free(pack);
+    zset->pack = NULL;
+    tree_build(zset, nodes.data(), nodes.size());
 }
 
 // update the score of an existing node
@@ -80,10 +293,19 @@ static void zset_update(ZSet *zset, ZNode *node, double score) {
     if (node->score == score) {
         return;
     }
+    if (zset->pack) {
+        return pack_update(zset->pack, node, score);
+    }
     // delete and re-insert
-    zset->tree = avl_del(&node->tree);
+    if (use_btree()) {
+        bt_erase(&zset->btree, node);
+        node->score = score;
+        return bt_insert(&zset->btree, node);
+    }
+    AVLNode *tnode = znode_avl(node);
+    zset->tree = avl_del(tnode);
     node->score = score;
-    avl_init(&node->tree);
+    avl_init(tnode);
     tree_add(zset, node);
 }
 
@@ -94,20 +316,41 @@ bool zset_add(ZSet *zset, const char *name, size_t len, double score) {
         // update the score of an existing pair
         zset_update(zset, node, score);
         return false;
-    } else {
-        // add a new ndoe
-        node = znode_new(name, len, score);
-        hm_insert(&zset->hmap, &node->hmap);
-        tree_add(zset, node);
-        return true;
     }
+    if (!zset->pack && !zset->tree && !zset->btree.root && pack_fits(1, len)) {
+        // empty, start packed
+        sm_destroy(&zset->hmap);
+        zset->pack = pack_new(rec_size(len) + sizeof(uint32_t));
+    }
+    if (zset->pack) {
+        if (pack_fits(zset->pack->n + 1, len)) {
+            pack_add(zset, name, len, score);
+            return true;
+        }
+        pack_convert(zset);
+    }
+    // add a new ndoe
+    node = znode_new(name, len, score);
+    sm_insert(&zset->hmap, znode_hmap(node));
+    tree_add(zset, node);
+    return true;
 }
 
 // delete
 
-// lookup and detach a node by name
+// lookup and detach a node by name.
+// the node is owned by the caller, even from a packed zset.
 ZNode *zset_pop(ZSet *zset, const char *name, size_t len) {
-    if (!zset->tree) {
+    if (zset->pack) {
+        ZNode *rec = pack_lookup(zset->pack, name, len);
+        if (!rec) {
+            return NULL;
+        }
+        ZNode *node = znode_new(rec->name, rec->len, rec->score);
+        pack_del(zset->pack, rec);
+        return node;
+    }
+    if (!zset->tree && !zset->btree.root) {
         return NULL;
     }
 
@@ -115,40 +358,112 @@ ZNode *zset_pop(ZSet *zset, const char *name, size_t len) {
     key.node.hcode = str_hash((uint8_t *)name, len);
     key.name = name;
     key.len = len;
-    HNode *found = hm_pop(&zset->hmap, &key.node, &hcmp);
+    SNode *found = sm_pop(&zset->hmap, &key.node, &hcmp);
     if (!found) {
         return NULL;
     }
 
-    ZNode *node = container_of(found, ZNode, hmap);
-    zset->tree = avl_del(&node->tree);
+    ZNode *node = hmap_znode(found);
+    if (use_btree()) {
+        bt_erase(&zset->btree, node);
+    } else {
+        zset->tree = avl_del(znode_avl(node));
+    }
     return node;
 };
 
-// deallocate the node
-void znode_del(ZNode *node) {
-    free(node);
-};
+size_t zset_size(ZSet *zset) {
+    if (zset->pack) {
+        return zset->pack->n;
+    }
+    return use_btree() ? bt_size(&zset->btree) : avl_cnt(zset->tree);
+}
+
+// the position of a member in (score, name) order
+int64_t zset_rank(ZSet *zset, ZNode *node) {
+    if (zset->pack) {
+        return (int64_t)pack_index(zset->pack, node);
+    }
+    return use_btree() ? bt_rank(&zset->btree, node) : avl_rank(znode_avl(node));
+}
+
+// the member at a position in (score, name) order, or NULL
+ZNode *zset_select(ZSet *zset, int64_t rank) {
+    if (rank < 0 || rank >= (int64_t)zset_size(zset)) {
+        return NULL;
+    }
+    if (zset->pack) {
+        return pack_at(zset->pack, (size_t)rank);
+    }
+    if (use_btree()) {
+        return bt_select(&zset->btree, (size_t)rank);
+    }
+    // the root is at the size of its left subtree
+    AVLNode *root = zset->tree;
+    return tree_znode(avl_offset(root, rank - (int64_t)avl_cnt(root->left)));
+}
 
 // range query
 ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len) {
+    if (zset->pack) {
+        size_t i = pack_lower_bound(zset->pack, score, name, len);
+        return i < zset->pack->n ? pack_at(zset->pack, i) : NULL;
+    }
+    if (use_btree()) {
+        return bt_lower_bound(&zset->btree, score, name, len);
+    }
     AVLNode *found = NULL;
     for (AVLNode *cur = zset->tree; cur;) {
-        if (zless(cur, score, name, len)) {
+        if (zless(tree_znode(cur), score, name, len)) {
             cur = cur->right;
         } else {
             found = cur; // candidate
             cur = cur->left;
         }
     }
-    return found ? container_of(found, ZNode, tree) : NULL;
+    return found ? tree_znode(found) : NULL;
 }
 
 // offset into the succeeding of preceding node
-ZNode *znode_offset(ZNode *node, int64_t offset) {
+ZNode *znode_offset(ZSet *zset, ZNode *node, int64_t offset) {
+    if (!node) {
+        return NULL;
+    }
+    if (zset->pack) {
+        int64_t i = (int64_t)pack_index(zset->pack, node) + offset;
+        bool ok = 0 <= i && i < (int64_t)zset->pack->n;
+        return ok ? pack_at(zset->pack, (size_t)i) : NULL;
+    }
+    if (use_btree()) {
+        return bt_offset(&zset->btree, node, offset);
+    }
     // walk to the n-th succesesor/predecessor (offset)
-    AVLNode *tnode = node ? avl_offset(&node->tree, offset) : NULL;
-    return tnode ? container_of(tnode, ZNode, tree) : NULL;
+    AVLNode *tnode = avl_offset(znode_avl(node), offset);
+    return tnode ? tree_znode(tnode) : NULL;
+}
+
+struct ScanCtx {
+    void (*f)(ZNode *, void *);
+    void *arg;
+};
+
+static void cb_scan(SNode *node, void *arg) {
+    ScanCtx *ctx = (ScanCtx *)arg;
+    ctx->f(hmap_znode(node), ctx->arg);
+}
+
+// visit some members and return the cursor to continue from, 0 at the end.
+// the tree encoding is scanned by the hash index (see sm_scan()),
+// a packed zset is small and visited at once.
+uint64_t zset_scan(ZSet *zset, uint64_t cursor, void (*f)(ZNode *, void *), void *arg) {
+    if (zset->pack) {
+        for (size_t i = 0; i < zset->pack->n; ++i) {
+            f(pack_at(zset->pack, i), arg);
+        }
+        return 0;
+    }
+    ScanCtx ctx = {f, arg};
+    return sm_scan(&zset->hmap, cursor, &cb_scan, &ctx);
 }
 
 static void tree_dispose(AVLNode *node) {
@@ -157,11 +472,45 @@ static void tree_dispose(AVLNode *node) {
     }
     tree_dispose(node->left);
     tree_dispose(node->right);
-    znode_del(container_of(node, ZNode, tree));
+    znode_del(tree_znode(node));
 }
 
 // destroy zset
 void zset_dispose(ZSet *zset) {
+    if (zset->pack) {
+        pack_free(zset->pack);
+        zset->pack = NULL;
+    }
     tree_dispose(zset->tree);
-    hm_destroy(&zset->hmap);
-}
\ No newline at end of file
+    zset->tree = NULL;
+    bt_dispose(&zset->btree, &znode_del);
+    sm_destroy(&zset->hmap);
+}
+
+// build an empty zset from nodes sorted by (score, name) with unique names,
+// such as a dump of another zset. O(n) instead of n zset_add() calls.
+// returns false and leaves the zset empty if the nodes are out of order.
+bool zset_build(ZSet *zset, ZNode **nodes, size_t n) {
+    size_t max_len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (i > 0 && !zless(nodes[i - 1], nodes[i])) {
+            return false;
+        }
+        max_len = max(max_len, nodes[i]->len);
+    }
+    if (n == 0 || !pack_fits(n, max_len)) {
+        tree_build(zset, nodes, n);
+        return true;
+    }
+    // small enough to pack, the records are appended in order
+    size_t cap = n * sizeof(uint32_t);
+    for (size_t i = 0; i < n; ++i) {
+        cap += rec_size(nodes[i]->len);
+    }
+    zset->pack = pack_new(cap);
+    for (size_t i = 0; i < n; ++i) {
+        pack_add(zset, nodes[i]->name, nodes[i]->len, nodes[i]->score);
+        znode_del(nodes[i]);
+    }
+    return true;
+}
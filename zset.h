@@ -1,25 +1,52 @@
 #pragma once
 
-#include "hashtable.h"
+#include "swisstable.h"
 #include "avl.h"
+#include "btree.h"
 
+struct ZPack;
+
+// a zset starts in the packed encoding, a sorted array in one buffer,
+// and is converted to the tree encoding (an ordered index + a hash index)
+// once it has more than g_zset_pack_max_n members or a name longer than
+// g_zset_pack_max_len. the ordered index is an AVL tree or a B+tree,
+// chosen for the whole process by g_zset_index.
 struct ZSet {
     AVLNode *tree = NULL;
-    HMap hmap;
+    BTree btree;
+    SwissMap hmap;
+    ZPack *pack = NULL;
+};
+
+enum {
+    ZINDEX_AVL = 0,
+    ZINDEX_BTREE = 1,
 };
 
+// set once at startup
+extern size_t g_zset_pack_max_n;
+extern size_t g_zset_pack_max_len;
+extern int g_zset_index;
+
+// a (score, name) pair. a pointer into a packed zset is only valid
+// until the zset is modified.
 struct ZNode {
-    AVLNode tree; // index by (score, name)
-    HNode hmap; // index by name
     double score = 0;
     size_t len = 0;
-    char name[0]; // variable length 
+    char name[0]; // variable length
 };
 
+ZNode *znode_new(const char *name, size_t len, double score);
+bool zset_build(ZSet *zset, ZNode **nodes, size_t n);
 ZNode *zset_lookup(ZSet *zset, const char *name, size_t len);
+void zset_prefetch(ZSet *zset, const char *name, size_t len);
 bool zset_add(ZSet *zset, const char *name, size_t len, double score);
 ZNode *zset_pop(ZSet *zset, const char *name, size_t len);
+size_t zset_size(ZSet *zset);
+int64_t zset_rank(ZSet *zset, ZNode *node);
+ZNode *zset_select(ZSet *zset, int64_t rank);
 void zset_dispose(ZSet *zset);
 void znode_del(ZNode *node);
 ZNode *zset_query(ZSet *zset, double score, const char *name, size_t len);
-ZNode *znode_offset(ZNode *node, int64_t offset);
\ No newline at end of file
+ZNode *znode_offset(ZSet *zset, ZNode *node, int64_t offset);
+uint64_t zset_scan(ZSet *zset, uint64_t cursor, void (*f)(ZNode *, void *), void *arg);